@@ -33,6 +33,8 @@
 #include "symkey.h"
 
 #include <list>
+#include <sstream>
+#include <stdlib.h>
 
 #define ENVELOPE_SECRETS "secrets"
 #define ENVELOPE_PUBKEYS "publickeys"
@@ -338,24 +340,68 @@ int action_encrypt (const std::string&recipient, bool armor,
 }
 
 
+/*
+ * byte range is FROM-TO with TO not included, either may be omitted to start
+ * from the beginning or continue to the end.
+ */
+static bool parse_range (const std::string&range, uint64_t&from, uint64_t&to)
+{
+	size_t dash = range.find ('-');
+	if (dash == std::string::npos) return false;
+
+	std::string f = range.substr (0, dash), t = range.substr (dash + 1);
+	char*end;
+
+	from = 0;
+	if (f.length()) {
+		if (f[0] < '0' || f[0] > '9') return false;
+		from = strtoull (f.c_str(), &end, 10);
+		if (*end) return false;
+	}
+
+	to = UINT64_MAX;
+	if (t.length()) {
+		if (t[0] < '0' || t[0] > '9') return false;
+		to = strtoull (t.c_str(), &end, 10);
+		if (*end) return false;
+	}
+
+	return from <= to;
+}
+
 static int action_sym_decrypt (const std::string&symmetric,
-                               const std::string&withlock, bool armor)
+                               const std::string&withlock,
+                               const std::string&range, bool armor)
 {
+	uint64_t from = 0, to = UINT64_MAX;
+	if (range.length() && !parse_range (range, from, to)) {
+		err ("error: invalid byte range");
+		return 1;
+	}
+
 	symkey sk;
 	if (!sk.load (symmetric, withlock, false, armor)) return 1;
 
-	int ret = sk.decrypt (std::cin, std::cout);
+	int ret;
+	if (range.length())
+		ret = sk.decrypt_range (std::cin, std::cout, from, to);
+	else ret = sk.decrypt (std::cin, std::cout);
 
 	if (ret) err ("error: decryption failed");
 	return ret;
 }
 
 int action_decrypt (bool armor, const std::string&symmetric,
-                    const std::string&withlock,
+                    const std::string&withlock, const std::string&range,
                     keyring&KR, algorithm_suite&AS)
 {
 	if (symmetric.length())
-		return action_sym_decrypt (symmetric, withlock, armor);
+		return action_sym_decrypt (symmetric, withlock, range, armor);
+
+	if (range.length()) {
+		err ("error: byte ranges work only with symmetric decryption");
+		return 1;
+	}
 
 	std::string data;
 	read_all_input (data);
@@ -462,9 +508,74 @@ int action_decrypt (bool armor, const std::string&symmetric,
 	return 0;
 }
 
-static int action_hash_sign (bool armor, const std::string&symmetric)
+/*
+ * hashfile options: comma-separated list of hashes to use, and the maximum
+ * read buffer size with an optional K/M/G suffix
+ */
+
+static bool parse_size (const std::string&str, uint64_t&size)
+{
+	if (!str.length() || str[0] < '0' || str[0] > '9') return false;
+
+	char*end;
+	size = strtoull (str.c_str(), &end, 10);
+
+	int shift = 0;
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		break;
+	}
+	if (shift) ++end;
+	if (*end || size > (SIZE_MAX >> shift)) return false;
+
+	size <<= shift;
+	return size > 0;
+}
+
+static bool hashfile_options (hashfile&hf, const std::string&hashes,
+                              const std::string&hash_buffer)
+{
+	std::stringstream ss (hashes);
+	std::string tok;
+	while (getline (ss, tok, ',')) {
+		if (!tok.length()) continue;
+		tok = to_unicase (tok);
+		if (tok != "SIZE64" && !hash_proc::suite().count (tok)) {
+			err ("error: unknown hash function selected");
+			return false;
+		}
+		hf.selection.insert (tok);
+	}
+
+	if (hash_buffer.length()) {
+		uint64_t size;
+		if (!parse_size (hash_buffer, size)) {
+			err ("error: invalid hash buffer size");
+			return false;
+		}
+		hf.max_buffer = size;
+	}
+
+	return true;
+}
+
+static int action_hash_sign (bool armor, const std::string&symmetric,
+                             const std::string&hashes,
+                             const std::string&hash_buffer)
 {
 	hashfile hf;
+	if (!hashfile_options (hf, hashes, hash_buffer)) return 1;
+
 	if (!hf.create (std::cin)) {
 		err ("error: hashing failed");
 		return 1;
@@ -508,12 +619,18 @@ static int action_hash_sign (bool armor, const std::string&symmetric)
 
 int action_sign (const std::string&user, bool armor, const std::string&detach,
                  bool clearsign, const std::string&symmetric,
+                 const std::string&hashes, const std::string&hash_buffer,
                  const std::string&withlock,
                  keyring&KR, algorithm_suite&AS)
 {
 	//symmetric processing has its own function
 	if (symmetric.length())
-		return action_hash_sign (armor, symmetric);
+		return action_hash_sign (armor, symmetric, hashes, hash_buffer);
+
+	if (hashes.length() || hash_buffer.length()) {
+		err ("error: hash options work only with symmetric signatures");
+		return 1;
+	}
 
 	/*
 	 * check detach/armor/clearsign validity first.
@@ -651,7 +768,9 @@ int action_sign (const std::string&user, bool armor, const std::string&detach,
 	return 0;
 }
 
-static int action_hash_verify (bool armor, const std::string&symmetric)
+static int action_hash_verify (bool armor, const std::string&symmetric,
+                               const std::string&hashes,
+                               const std::string&hash_buffer)
 {
 	// first, input the hashfile
 	std::ifstream hf_in;
@@ -695,6 +814,8 @@ static int action_hash_verify (bool armor, const std::string&symmetric)
 	}
 
 	hashfile hf;
+	if (!hashfile_options (hf, hashes, hash_buffer)) return 1;
+
 	if (!hf.unserialize (H)) {
 		err ("error: could not parse input structure");
 		return 1;
@@ -710,12 +831,19 @@ static int action_hash_verify (bool armor, const std::string&symmetric)
 
 int action_verify (bool armor, const std::string&detach,
                    bool clearsign, bool yes, const std::string&symmetric,
+                   const std::string&hashes, const std::string&hash_buffer,
                    const std::string&withlock,
                    keyring&KR, algorithm_suite&AS)
 {
 	//symmetric processing has its own function
 	if (symmetric.length())
-		return action_hash_verify (armor, symmetric);
+		return action_hash_verify (armor, symmetric,
+		                           hashes, hash_buffer);
+
+	if (hashes.length() || hash_buffer.length()) {
+		err ("error: hash options work only with symmetric signatures");
+		return 1;
+	}
 
 	/*
 	 * check flags validity, open detach if possible
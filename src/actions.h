@@ -42,14 +42,17 @@ int action_encrypt (const std::string&recipient, bool armor,
                     keyring&, algorithm_suite&);
 
 int action_decrypt (bool armor, const std::string&symmetric,
-                    const std::string&withlock, keyring&, algorithm_suite&);
+                    const std::string&withlock, const std::string&range,
+                    keyring&, algorithm_suite&);
 
 int action_sign (const std::string&user, bool armor, const std::string&detach,
                  bool clearsign, const std::string&symmetric,
+                 const std::string&hashes, const std::string&hash_buffer,
                  const std::string&withlock, keyring&, algorithm_suite&);
 
 int action_verify (bool armor, const std::string&detach,
                    bool clearsign, bool yes, const std::string&symmetric,
+                   const std::string&hashes, const std::string&hash_buffer,
                    const std::string&withlock, keyring&, algorithm_suite&);
 
 int action_sign_encrypt (const std::string&user, const std::string&recipient,
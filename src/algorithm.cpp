@@ -0,0 +1,44 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "algorithm.h"
+
+#include "threadpool.h"
+
+void algorithm::decrypt_batch (const std::vector<bvector>&ciphers,
+                               std::vector<bvector>&plains,
+                               std::vector<int>&status,
+                               sencode* privkey, uint threads)
+{
+	plains.clear();
+	plains.resize (ciphers.size());
+	status.clear();
+	status.resize (ciphers.size(), -1);
+
+	prepared_key*pk = prepare_privkey (privkey);
+	thread_pool pool (threads);
+
+	pool.run (ciphers.size(), [&] (size_t i) {
+		status[i] = pk ? decrypt_prepared (ciphers[i], plains[i], pk)
+		            : decrypt (ciphers[i], plains[i], privkey);
+	});
+
+	delete pk;
+}
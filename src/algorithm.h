@@ -34,6 +34,24 @@
  * the handy algorithm name.
  */
 
+/*
+ * key unserialized and precomputed for repeated use, as returned by
+ * algorithm::prepare_pubkey() or prepare_privkey(). Owned by the caller.
+ */
+
+class prepared_key
+{
+public:
+	virtual ~prepared_key() {}
+};
+
+template<class key_type>
+class prepared_key_of : public prepared_key
+{
+public:
+	key_type key;
+};
+
 class algorithm
 {
 public:
@@ -55,11 +73,43 @@ public:
 		return -1;
 	}
 
+	/*
+	 * bulk encryption for the same recipient; prepare_pubkey returns NULL
+	 * if the key is unusable or the algorithm doesn't support it.
+	 */
+	virtual prepared_key* prepare_pubkey (sencode*) {
+		return NULL;
+	}
+
+	virtual int encrypt_prepared (const bvector&, bvector&,
+	                              prepared_key*, prng&) {
+		return -1;
+	}
+
 	virtual int decrypt (const bvector&cipher, bvector&plain,
 	                     sencode* privkey) {
 		return -1;
 	}
 
+	virtual prepared_key* prepare_privkey (sencode*) {
+		return NULL;
+	}
+
+	virtual int decrypt_prepared (const bvector&, bvector&,
+	                              prepared_key*) {
+		return -1;
+	}
+
+	/*
+	 * decrypt many ciphertexts with the same key (prepared only once if
+	 * the algorithm supports it), using `threads' threads (0 = all cores).
+	 * status gets the decrypt() result for each ciphertext.
+	 */
+	void decrypt_batch (const std::vector<bvector>&ciphers,
+	                    std::vector<bvector>&plains,
+	                    std::vector<int>&status,
+	                    sencode* privkey, uint threads = 1);
+
 	virtual int sign (const bvector&msg, bvector&sig,
 	                  sencode** privkey, bool&dirty, prng&rng) {
 		return -1;
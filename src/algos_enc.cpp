@@ -21,6 +21,7 @@
 #include "algos_enc.h"
 
 #include "mce_qcmdpc.h"
+#include "threadpool.h"
 #include "arcfour.h"
 #include "chacha.h"
 #include "xsynd.h"
@@ -224,14 +225,10 @@ template < class pubkey_type,
            class scipher,
            int ranksize >
 static int fo_encrypt (const bvector&plain, bvector&cipher,
-                       sencode* pubkey, prng&rng)
+                       pubkey_type&Pub, prng&rng)
 {
 	uint i;
 
-	//load the key
-	pubkey_type Pub;
-	if (!Pub.unserialize (pubkey)) return 1;
-
 	//verify that key parameters match our scheme
 	if (Pub.plain_size() != plainsize) return 2;
 	if (Pub.cipher_size() != ciphersize) return 3;
@@ -282,7 +279,7 @@ static int fo_encrypt (const bvector&plain, bvector&cipher,
 	sc.load_key_vector (K);
 
 	//encrypt
-	for (i = 0; i < M.size(); ++i) M[i] = M[i] ^ sc.gen();
+	sc.xor_into (M.data(), M.size());
 
 	//append the message part to the key block.
 	bvector Mb;
@@ -291,6 +288,59 @@ static int fo_encrypt (const bvector&plain, bvector&cipher,
 	return 0;
 }
 
+template < class pubkey_type,
+           int plainsize,
+           int ciphersize,
+           int errorcount,
+           class hash_type,
+           class pad_hash_type,
+           class scipher,
+           int ranksize >
+static int fo_encrypt (const bvector&plain, bvector&cipher,
+                       sencode* pubkey, prng&rng)
+{
+	//load the key
+	pubkey_type Pub;
+	if (!Pub.unserialize (pubkey)) return 1;
+
+	return fo_encrypt
+	       < pubkey_type, plainsize, ciphersize, errorcount,
+	       hash_type, pad_hash_type, scipher, ranksize >
+	       (plain, cipher, Pub, rng);
+}
+
+template < class pubkey_type,
+           int plainsize,
+           int ciphersize,
+           int errorcount,
+           class hash_type,
+           class pad_hash_type,
+           class scipher,
+           int ranksize >
+static int fo_encrypt (const bvector&plain, bvector&cipher,
+                       prepared_key* pubkey, prng&rng)
+{
+	prepared_key_of<pubkey_type>*p =
+	    dynamic_cast<prepared_key_of<pubkey_type>*> (pubkey);
+	if (!p) return 1;
+
+	return fo_encrypt
+	       < pubkey_type, plainsize, ciphersize, errorcount,
+	       hash_type, pad_hash_type, scipher, ranksize >
+	       (plain, cipher, p->key, rng);
+}
+
+template<class key_type>
+static prepared_key* fo_prepare_key (sencode* key)
+{
+	prepared_key_of<key_type>*p = new prepared_key_of<key_type>;
+	if (!p->key.unserialize (key) || p->key.prepare()) {
+		delete p;
+		return NULL;
+	}
+	return p;
+}
+
 template < class privkey_type,
            int plainsize,
            int ciphersize,
@@ -300,16 +350,10 @@ template < class privkey_type,
            class scipher,
            int ranksize >
 static int fo_decrypt (const bvector&cipher, bvector&plain,
-                       sencode* privkey)
+                       privkey_type&Priv)
 {
 	uint i;
 
-	//load the key
-	privkey_type Priv;
-	if (!Priv.unserialize (privkey)) return 1;
-
-	if (Priv.prepare()) return 100;
-
 	//verify that key parameters match the scheme
 	if (Priv.plain_size() != plainsize) return 2;
 	if (Priv.cipher_size() != ciphersize) return 3;
@@ -376,7 +420,7 @@ static int fo_decrypt (const bvector&cipher, bvector&plain,
 	sc.load_key_vector (K);
 
 	//decrypt the message part
-	for (i = 0; i < M.size(); ++i) M[i] = M[i] ^ sc.gen();
+	sc.xor_into (M.data(), M.size());
 
 	//compute the hash of K+M
 	std::vector<byte>H, M2;
@@ -401,6 +445,58 @@ static int fo_decrypt (const bvector&cipher, bvector&plain,
 	return 0;
 }
 
+template < class privkey_type,
+           int plainsize,
+           int ciphersize,
+           int errorcount,
+           class hash_type,
+           class pad_hash_type,
+           class scipher,
+           int ranksize >
+static int fo_decrypt (const bvector&cipher, bvector&plain,
+                       sencode* privkey)
+{
+	//load the key
+	privkey_type Priv;
+	if (!Priv.unserialize (privkey)) return 1;
+
+	if (Priv.prepare()) return 100;
+
+	//a single message can be decoded on several threads
+	thread_pool*pool = NULL;
+	if (default_threads() != 1)
+		Priv.pool = pool = new thread_pool (default_threads());
+
+	int ret = fo_decrypt
+	          < privkey_type, plainsize, ciphersize, errorcount,
+	          hash_type, pad_hash_type, scipher, ranksize >
+	          (cipher, plain, Priv);
+
+	delete pool;
+	return ret;
+}
+
+template < class privkey_type,
+           int plainsize,
+           int ciphersize,
+           int errorcount,
+           class hash_type,
+           class pad_hash_type,
+           class scipher,
+           int ranksize >
+static int fo_decrypt (const bvector&cipher, bvector&plain,
+                       prepared_key* privkey)
+{
+	prepared_key_of<privkey_type>*p =
+	    dynamic_cast<prepared_key_of<privkey_type>*> (privkey);
+	if (!p) return 1;
+
+	return fo_decrypt
+	       < privkey_type, plainsize, ciphersize, errorcount,
+	       hash_type, pad_hash_type, scipher, ranksize >
+	       (cipher, plain, p->key);
+}
+
 /*
  * Instances for MCE-QCMDPC algorithms
  */
@@ -442,6 +538,23 @@ int algo_mceqcmdpc##name::encrypt (const bvector&plain, bvector&cipher, \
 	       ranksize > \
 	       (plain, cipher, pubkey, rng); \
 } \
+prepared_key* algo_mceqcmdpc##name::prepare_pubkey (sencode* pubkey) \
+{ \
+	return fo_prepare_key<mce_qcmdpc::pubkey> (pubkey); \
+} \
+int algo_mceqcmdpc##name::encrypt_prepared (const bvector&plain, \
+                                        bvector&cipher, \
+                                        prepared_key* pubkey, prng&rng) \
+{ \
+	return fo_encrypt \
+	       < mce_qcmdpc::pubkey, \
+	       bs*(bc-1), bs*bc, errcount, \
+	       hash_type, \
+	       pad_hash_type, \
+	       scipher, \
+	       ranksize > \
+	       (plain, cipher, pubkey, rng); \
+} \
 int algo_mceqcmdpc##name::decrypt (const bvector&cipher, bvector&plain, \
                                sencode* privkey) \
 { \
@@ -453,6 +566,23 @@ int algo_mceqcmdpc##name::decrypt (const bvector&cipher, bvector&plain, \
 	       scipher, \
 	       ranksize > \
 	       (cipher, plain, privkey); \
+} \
+prepared_key* algo_mceqcmdpc##name::prepare_privkey (sencode* privkey) \
+{ \
+	return fo_prepare_key<mce_qcmdpc::privkey> (privkey); \
+} \
+int algo_mceqcmdpc##name::decrypt_prepared (const bvector&cipher, \
+                                        bvector&plain, \
+                                        prepared_key* privkey) \
+{ \
+	return fo_decrypt \
+	       < mce_qcmdpc::privkey, \
+	       bs*(bc-1), bs*bc, errcount, \
+	       hash_type, \
+	       pad_hash_type, \
+	       scipher, \
+	       ranksize > \
+	       (cipher, plain, privkey); \
 }
 
 
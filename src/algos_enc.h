@@ -38,8 +38,14 @@ public: \
 	} \
 	int encrypt (const bvector&plain, bvector&cipher, \
 	             sencode* pubkey, prng&rng); \
+	prepared_key* prepare_pubkey (sencode* pubkey); \
+	int encrypt_prepared (const bvector&plain, bvector&cipher, \
+	                      prepared_key* pubkey, prng&rng); \
 	int decrypt (const bvector&cipher, bvector&plain, \
 	             sencode* privkey); \
+	prepared_key* prepare_privkey (sencode* privkey); \
+	int decrypt_prepared (const bvector&cipher, bvector&plain, \
+	                      prepared_key* privkey); \
 	int create_keypair (sencode**pub, sencode**priv, prng&rng); \
 }
 
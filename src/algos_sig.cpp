@@ -23,6 +23,8 @@
 #include "fmtseq.h"
 #include "hash.h"
 #include "chacha.h"
+#include "threadpool.h"
+#include "factoryof.h"
 
 /*
  * DISCUSSION.
@@ -158,11 +160,21 @@ static int fmtseq_create_keypair (sencode**pub, sencode**priv, prng&rng)
 	fmtseq::pubkey Pub;
 	fmtseq::privkey Priv;
 
-	treehash hf;
-	generator g;
-
-	if (fmtseq::generate (Pub, Priv, rng, hf, g, hs, h, l))
-		return 1;
+	uint threads = default_threads();
+	if (threads == 1) {
+		treehash hf;
+		generator g;
+
+		if (fmtseq::generate (Pub, Priv, rng, hf, g, hs, h, l))
+			return 1;
+	} else {
+		factoryof<hash_func, treehash> hff;
+		factoryof<streamcipher, generator> gf;
+		thread_pool pool (threads);
+
+		if (fmtseq::generate (Pub, Priv, rng, hff, gf, hs, h, l, pool))
+			return 1;
+	}
 
 	*pub = Pub.serialize();
 	*priv = Priv.serialize();
@@ -114,6 +114,10 @@ public:
 			for (size_t i = 0; i < n; ++i) gen();
 	}
 
+	void xor_into (byte*data, size_t n) {
+		for (size_t i = 0; i < n; ++i) data[i] ^= gen();
+	}
+
 	void genw (size_t n, inttype*out) {
 		if (out)
 			for (size_t i = 0; i < n; ++i) out[i] = genw();
@@ -21,6 +21,7 @@
 #include "bvector.h"
 #include "gf2m.h"
 #include "polynomial.h"
+#include "qc_kernels.h"
 
 const uint64_t ones = 0xFfffFfffFfffFfffull;
 
@@ -184,6 +185,33 @@ void bvector::rot_add (const bvector&a, size_t rot)
 	}
 }
 
+/*
+ * Multiplication by a sparse circulant, i.e. sum of rot_add's. Done on whole
+ * words by the qc kernels, which is the fast way if there are only tens of
+ * rotations.
+ */
+void bvector::rot_add_sparse (const bvector&a, const std::vector<uint>&rots)
+{
+	size_t as = a._size;
+	if (!as) return;
+	if (_size < as) resize (as, 0);
+
+	//rotation by r is a read of the doubled vector at offset as-r
+	std::vector<uint> offsets;
+	offsets.reserve (rots.size());
+	for (size_t i = 0; i < rots.size(); ++i)
+		offsets.push_back (as - rots[i] % as);
+
+	size_t words = qc_words (as);
+	std::vector<uint64_t> dbl, out;
+	qc_double (a.words(), as, dbl);
+	out.resize (words, 0);
+	qc_xor_rotations (dbl, offsets, out.data(), 0, words);
+	qc_mask_padding (out.data(), as, words);
+
+	for (size_t i = 0; i < datasize (as); ++i) _data[i] ^= out[i];
+}
+
 void bvector::set_block (const bvector&a, size_t offset)
 {
 	if (offset + a.size() > size()) resize (offset + a.size(), 0);
@@ -134,6 +134,18 @@ public:
 
 	void resize (size_t size, bool def = false);
 
+	/*
+	 * raw access to the 64bit blocks for bulk kernels. Users must keep
+	 * the unused bits zeroed.
+	 */
+	inline uint64_t* words() {
+		return _data.data();
+	}
+
+	inline const uint64_t* words() const {
+		return _data.data();
+	}
+
 	inline void reserve (size_t size) {
 		_data.reserve (datasize (size));
 	}
@@ -189,6 +201,8 @@ public:
 	void add_offset (const bvector&, size_t offset_to);
 	void add_range (const bvector&, size_t, size_t);
 	void rot_add (const bvector&, size_t);
+	//add a * sum of x^rot in GF(2)[x]/(x^n-1) with n = a.size()
+	void rot_add_sparse (const bvector&a, const std::vector<uint>&rots);
 	void set_block (const bvector&, size_t);
 	void get_block (size_t start, size_t cnt, bvector&) const;
 	uint and_hamming_weight (const bvector&) const;
@@ -20,13 +20,18 @@
 
 #include "chacha.h"
 
-void chacha_gen (const uint32_t*key, const uint32_t*counter, uint32_t*out)
+#include "simd.h"
+
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static void chacha_state (const uint32_t*key, const uint32_t*counter,
+                          uint32_t*j)
 {
-	uint32_t j[16], x[16];
 	int i;
 	static const char sigma[] = "expand 32-byte k";
 
-	//key setup
 	for (i = 0; i < 4; ++i)
 		j[i] = ( (uint32_t*) sigma) [i]; //constants
 
@@ -38,13 +43,22 @@ void chacha_gen (const uint32_t*key, const uint32_t*counter, uint32_t*out)
 
 	for (i = 0; i < 2; ++i)
 		j[12 + i] = counter[i]; //counter
-
-	//rounds&mixing
-	for (i = 0; i < 16; ++i) x[i] = j[i];
+}
 
 #define rotl32(val,n) \
 	(((uint32_t)((val)<<(n)))|((val)>>(32-(n))))
 
+void chacha_gen (const uint32_t*key, const uint32_t*counter, uint32_t*out)
+{
+	uint32_t j[16], x[16];
+	int i;
+
+	//key setup
+	chacha_state (key, counter, j);
+
+	//rounds&mixing
+	for (i = 0; i < 16; ++i) x[i] = j[i];
+
 #define qtrround(a,b,c,d) \
 	x[a]=x[a]+x[b]; x[d]=rotl32(x[d]^x[a], 16); \
 	x[c]=x[c]+x[d]; x[b]=rotl32(x[b]^x[c], 12); \
@@ -72,6 +86,219 @@ void chacha_incr_counter (uint32_t*counter)
 	if (!counter[0]) counter[1]++;
 }
 
+static void chacha_add_counter (uint32_t*counter, uint64_t n)
+{
+	uint64_t c = ( (uint64_t) counter[1] << 32 | counter[0]) + n;
+	counter[0] = (uint32_t) c;
+	counter[1] = (uint32_t) (c >> 32);
+}
+
+/*
+ * Multi-block kernels compute W blocks at once, each vector holds the same
+ * state word of W consecutive blocks. The output is transposed back to the
+ * block layout of chacha_gen 4 words at a time, by 4x4 transposes within the
+ * 128bit lanes. All return the number of blocks done and move the counter.
+ */
+
+#if CCR_X86_SIMD
+
+//lane counters for W consecutive blocks
+static void chacha_lane_counters (const uint32_t*counter, int W,
+                                  uint32_t*lo, uint32_t*hi)
+{
+	for (int i = 0; i < W; ++i) {
+		uint32_t c[2] = {counter[0], counter[1]};
+		chacha_add_counter (c, i);
+		lo[i] = c[0];
+		hi[i] = c[1];
+	}
+}
+
+#define chacha_vrounds(ADD,XOR,ROTL) \
+	for (i = 0; i < 10; ++i) { \
+		vqtrround (0, 4, 8, 12, ADD, XOR, ROTL); \
+		vqtrround (1, 5, 9, 13, ADD, XOR, ROTL); \
+		vqtrround (2, 6, 10, 14, ADD, XOR, ROTL); \
+		vqtrround (3, 7, 11, 15, ADD, XOR, ROTL); \
+		vqtrround (0, 5, 10, 15, ADD, XOR, ROTL); \
+		vqtrround (1, 6, 11, 12, ADD, XOR, ROTL); \
+		vqtrround (2, 7, 8, 13, ADD, XOR, ROTL); \
+		vqtrround (3, 4, 9, 14, ADD, XOR, ROTL); \
+	}
+
+#define vqtrround(a,b,c,d,ADD,XOR,ROTL) \
+	x[a]=ADD(x[a],x[b]); x[d]=ROTL(XOR(x[d],x[a]), 16); \
+	x[c]=ADD(x[c],x[d]); x[b]=ROTL(XOR(x[b],x[c]), 12); \
+	x[a]=ADD(x[a],x[b]); x[d]=ROTL(XOR(x[d],x[a]), 8); \
+	x[c]=ADD(x[c],x[d]); x[b]=ROTL(XOR(x[b],x[c]), 7);
+
+//4x4 transpose of 32bit words within 128bit lanes
+#define chacha_transpose(UNLO32,UNHI32,UNLO64,UNHI64,a,b,c,d) do { \
+	t0 = UNLO32 (a, b); t1 = UNLO32 (c, d); \
+	t2 = UNHI32 (a, b); t3 = UNHI32 (c, d); \
+	a = UNLO64 (t0, t1); b = UNHI64 (t0, t1); \
+	c = UNLO64 (t2, t3); d = UNHI64 (t2, t3); } while (0)
+
+#define sse2_rotl(v,n) \
+	_mm_or_si128 (_mm_slli_epi32 (v, n), _mm_srli_epi32 (v, 32 - (n)))
+
+CCR_TARGET ("sse2")
+static size_t chacha_blocks_sse2 (const uint32_t*key, uint32_t*counter,
+                                  byte*out, size_t n)
+{
+	size_t done;
+	int i, g;
+	uint32_t s[16], lo[4], hi[4];
+	__m128i j[16], x[16], t0, t1, t2, t3;
+
+	chacha_state (key, counter, s);
+	for (i = 0; i < 16; ++i) j[i] = _mm_set1_epi32 (s[i]);
+
+	for (done = 0; done + 4 <= n; done += 4, out += 4 * 64) {
+		chacha_lane_counters (counter, 4, lo, hi);
+		j[12] = _mm_loadu_si128 ( (__m128i*) lo);
+		j[13] = _mm_loadu_si128 ( (__m128i*) hi);
+		for (i = 0; i < 16; ++i) x[i] = j[i];
+
+		chacha_vrounds (_mm_add_epi32, _mm_xor_si128, sse2_rotl);
+
+		for (i = 0; i < 16; ++i) x[i] = _mm_add_epi32 (x[i], j[i]);
+		for (g = 0; g < 16; g += 4) {
+			chacha_transpose (_mm_unpacklo_epi32, _mm_unpackhi_epi32,
+			                  _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+			                  x[g], x[g + 1], x[g + 2], x[g + 3]);
+			for (i = 0; i < 4; ++i)
+				_mm_storeu_si128 ( (__m128i*) (out + 64 * i + 4 * g),
+				                   x[g + i]);
+		}
+		chacha_add_counter (counter, 4);
+	}
+	return done;
+}
+
+#define avx2_rotl(v,n) \
+	_mm256_or_si256 (_mm256_slli_epi32 (v, n), _mm256_srli_epi32 (v, 32 - (n)))
+
+CCR_TARGET ("avx2")
+static size_t chacha_blocks_avx2 (const uint32_t*key, uint32_t*counter,
+                                  byte*out, size_t n)
+{
+	size_t done;
+	int i, g;
+	uint32_t s[16], lo[8], hi[8];
+	__m256i j[16], x[16], t0, t1, t2, t3;
+
+	chacha_state (key, counter, s);
+	for (i = 0; i < 16; ++i) j[i] = _mm256_set1_epi32 (s[i]);
+
+	for (done = 0; done + 8 <= n; done += 8, out += 8 * 64) {
+		chacha_lane_counters (counter, 8, lo, hi);
+		j[12] = _mm256_loadu_si256 ( (__m256i*) lo);
+		j[13] = _mm256_loadu_si256 ( (__m256i*) hi);
+		for (i = 0; i < 16; ++i) x[i] = j[i];
+
+		chacha_vrounds (_mm256_add_epi32, _mm256_xor_si256, avx2_rotl);
+
+		for (i = 0; i < 16; ++i) x[i] = _mm256_add_epi32 (x[i], j[i]);
+		for (g = 0; g < 16; g += 4) {
+			chacha_transpose (_mm256_unpacklo_epi32,
+			                  _mm256_unpackhi_epi32,
+			                  _mm256_unpacklo_epi64,
+			                  _mm256_unpackhi_epi64,
+			                  x[g], x[g + 1], x[g + 2], x[g + 3]);
+			//lane 0 has blocks 0-3, lane 1 has blocks 4-7
+			for (i = 0; i < 4; ++i) {
+				_mm_storeu_si128 ( (__m128i*) (out + 64 * i + 4 * g),
+				                   _mm256_castsi256_si128 (x[g + i]));
+				_mm_storeu_si128 ( (__m128i*) (out + 64 * (i + 4) + 4 * g),
+				                   _mm256_extracti128_si256 (x[g + i], 1));
+			}
+		}
+		chacha_add_counter (counter, 8);
+	}
+	return done;
+}
+
+/*
+ * masked forms avoid GCC's maybe-uninitialized warnings on the passthrough
+ * operand of the plain AVX-512 intrinsics
+ */
+#define avx512_rotl(v,n) _mm512_maskz_rol_epi32 (0xffff, v, n)
+#define avx512_unlo32(a,b) _mm512_maskz_unpacklo_epi32 (0xffff, a, b)
+#define avx512_unhi32(a,b) _mm512_maskz_unpackhi_epi32 (0xffff, a, b)
+#define avx512_unlo64(a,b) _mm512_maskz_unpacklo_epi64 (0xff, a, b)
+#define avx512_unhi64(a,b) _mm512_maskz_unpackhi_epi64 (0xff, a, b)
+#define avx512_lane(v,l) _mm512_maskz_extracti32x4_epi32 (0xf, v, l)
+
+CCR_TARGET ("avx512f")
+static size_t chacha_blocks_avx512 (const uint32_t*key, uint32_t*counter,
+                                    byte*out, size_t n)
+{
+	size_t done;
+	int i, g;
+	uint32_t s[16], lo[16], hi[16];
+	__m512i j[16], x[16], t0, t1, t2, t3;
+
+	chacha_state (key, counter, s);
+	for (i = 0; i < 16; ++i) j[i] = _mm512_set1_epi32 (s[i]);
+
+	for (done = 0; done + 16 <= n; done += 16, out += 16 * 64) {
+		chacha_lane_counters (counter, 16, lo, hi);
+		j[12] = _mm512_loadu_si512 (lo);
+		j[13] = _mm512_loadu_si512 (hi);
+		for (i = 0; i < 16; ++i) x[i] = j[i];
+
+		chacha_vrounds (_mm512_add_epi32, _mm512_xor_si512, avx512_rotl);
+
+		for (i = 0; i < 16; ++i) x[i] = _mm512_add_epi32 (x[i], j[i]);
+		for (g = 0; g < 16; g += 4) {
+			chacha_transpose (avx512_unlo32, avx512_unhi32,
+			                  avx512_unlo64, avx512_unhi64,
+			                  x[g], x[g + 1], x[g + 2], x[g + 3]);
+			//lane L has blocks 4L to 4L+3
+			for (i = 0; i < 4; ++i) {
+				byte*o = out + 64 * i + 4 * g;
+				_mm_storeu_si128 ( (__m128i*) o,
+				                   avx512_lane (x[g + i], 0));
+				_mm_storeu_si128 ( (__m128i*) (o + 4 * 64),
+				                   avx512_lane (x[g + i], 1));
+				_mm_storeu_si128 ( (__m128i*) (o + 8 * 64),
+				                   avx512_lane (x[g + i], 2));
+				_mm_storeu_si128 ( (__m128i*) (o + 12 * 64),
+				                   avx512_lane (x[g + i], 3));
+			}
+		}
+		chacha_add_counter (counter, 16);
+	}
+	return done;
+}
+
+#endif //CCR_X86_SIMD
+
+//generate n whole blocks to out, moving the counter
+static void chacha_gen_blocks (const uint32_t*key, uint32_t*counter,
+                               byte*out, size_t n)
+{
+	size_t done = 0;
+
+#if CCR_X86_SIMD
+	static bool avx512 = cpu_has_avx512(), avx2 = cpu_has_avx2(),
+	            sse2 = cpu_has_sse2();
+
+	if (avx512)
+		done += chacha_blocks_avx512 (key, counter, out, n);
+	if (avx2)
+		done += chacha_blocks_avx2 (key, counter, out + 64 * done, n - done);
+	if (sse2)
+		done += chacha_blocks_sse2 (key, counter, out + 64 * done, n - done);
+#endif
+
+	for (; done < n; ++done) {
+		chacha_gen (key, counter, (uint32_t*) (out + 64 * done));
+		chacha_incr_counter (counter);
+	}
+}
+
 void chacha20::init()
 {
 	for (int i = 0; i < 10; ++i) key[i] = 0;
@@ -117,12 +344,12 @@ void chacha20::gen (size_t n, byte*out)
 	}
 
 	//fill in whole blocks
-	while (n >= 64) {
-		if (out) chacha_gen (key, counter, (uint32_t*) out);
-
-		chacha_incr_counter (counter);
-		out += 64;
-		n -= 64;
+	if (n >= 64) {
+		if (out) {
+			chacha_gen_blocks (key, counter, out, n / 64);
+			out += n / 64 * 64;
+		} else chacha_add_counter (counter, n / 64);
+		n %= 64;
 	}
 
 	if (!n) return;
@@ -138,3 +365,32 @@ void chacha20::gen (size_t n, byte*out)
 		--n;
 	}
 }
+
+void chacha20::xor_into (byte*data, size_t n)
+{
+	while (n && blockpos < 64) {
+		* (data++) ^= block[blockpos++];
+		--n;
+	}
+
+	//keystream goes through a cache-sized chunk
+	byte tmp[16 * 64];
+	while (n >= 64) {
+		size_t blocks = n / 64;
+		if (blocks > 16) blocks = 16;
+		chacha_gen_blocks (key, counter, tmp, blocks);
+		xor_bytes (data, tmp, blocks * 64);
+		data += blocks * 64;
+		n -= blocks * 64;
+	}
+
+	if (!n) return;
+	blockpos = 0;
+	chacha_gen (key, counter, (uint32_t*) block);
+	chacha_incr_counter (counter);
+
+	while (n) {
+		* (data++) ^= block[blockpos++];
+		--n;
+	}
+}
@@ -51,6 +51,7 @@ public:
 	void load_key (const byte*begin, const byte*end);
 	byte gen();
 	void gen (size_t n, byte*out);
+	void xor_into (byte*data, size_t n);
 
 	size_t key_size() {
 		return 32 + 8;
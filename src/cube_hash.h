@@ -30,22 +30,23 @@ public:
 		return H;
 	}
 
-	std::vector<byte> operator() (const std::vector<byte>&a) {
+	void hash (const byte*a, size_t len, byte*out) {
 		cubehash_state<I, R, B, F, H> state;
 		size_t i;
 
 		state.init();
 
-		for (i = 0; i + B <= a.size(); i += B)
-			state.process_block (a.data() + i);
+		for (i = 0; i + B <= len; i += B)
+			state.process_block (a + i);
 
-		state.process_final_incomplete_block (a.data() + i,
-		                                      a.size() - i);
+		state.process_final_incomplete_block (a + i, len - i);
+		state.get_hash (out);
+	}
 
-		std::vector<byte> result;
-		result.resize (H, 0);
-		state.get_hash (result.data());
-		return result;
+	void hash_many (const byte*in, size_t len, size_t n, byte*out) {
+		cubehash_state<I, R, B, F, H> iv;
+		iv.init();
+		cubehash_many (iv.state(), R, B, F, H, in, len, n, out);
 	}
 };
 
@@ -84,12 +85,9 @@ public:
 			buf[bpos] = a[apos];
 	}
 
-	std::vector<byte> finish() {
+	void finish (byte*out) {
 		state.process_final_incomplete_block (buf, bpos);
-		std::vector<byte> result;
-		result.resize (H, 0);
-		state.get_hash (result.data());
-		return result;
+		state.get_hash (out);
 	}
 };
 
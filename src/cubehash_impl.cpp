@@ -0,0 +1,279 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cubehash_impl.h"
+
+#include "simd.h"
+
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define ROT(a,b,n) (((a) << (b)) | ((a) >> (n - b)))
+#define i16(cmd) for(i=0;i<16;++i) cmd;
+
+static void cubehash_rounds_generic (uint32_t*X, uint n)
+{
+	int i;
+	uint32_t T[16];
+	for (; n; --n) {
+		i16 (X[i + 16] += X[i]);
+		i16 (T[i ^ 8] = X[i]);
+		i16 (X[i] = ROT (T[i], 7, 32));
+		i16 (X[i] ^= X[i + 16]);
+		i16 (T[i ^ 2] = X[i + 16]);
+		i16 (X[i + 16] = T[i]);
+		i16 (X[i + 16] += X[i]);
+		i16 (T[i ^ 4] = X[i]);
+		i16 (X[i] = ROT (T[i], 11, 32));
+		i16 (X[i] ^= X[i + 16]);
+		i16 (T[i ^ 1] = X[i + 16]);
+		i16 (X[i + 16] = T[i]);
+	}
+}
+
+#if CCR_X86_SIMD
+
+/*
+ * The index permutations of the round map to vector shuffles: i^8 and i^4
+ * swap whole registers (or 128bit halves), i^2 and i^1 are in-lane word
+ * shuffles.
+ */
+
+#define sse2_rot(v,b) \
+	_mm_or_si128 (_mm_slli_epi32 (v, b), _mm_srli_epi32 (v, 32 - (b)))
+
+CCR_TARGET ("sse2")
+static void cubehash_rounds_sse2 (uint32_t*X, uint n)
+{
+	int i;
+	__m128i x[8], t;
+
+	for (i = 0; i < 8; ++i) x[i] = _mm_loadu_si128 ( (__m128i*) (X + 4 * i));
+
+	for (; n; --n) {
+		for (i = 0; i < 4; ++i) x[i + 4] = _mm_add_epi32 (x[i + 4], x[i]);
+		t = x[0];
+		x[0] = sse2_rot (x[2], 7);
+		x[2] = sse2_rot (t, 7);
+		t = x[1];
+		x[1] = sse2_rot (x[3], 7);
+		x[3] = sse2_rot (t, 7);
+		for (i = 0; i < 4; ++i) {
+			x[i] = _mm_xor_si128 (x[i], x[i + 4]);
+			x[i + 4] = _mm_shuffle_epi32 (x[i + 4], 0x4e);
+			x[i + 4] = _mm_add_epi32 (x[i + 4], x[i]);
+		}
+		t = x[0];
+		x[0] = sse2_rot (x[1], 11);
+		x[1] = sse2_rot (t, 11);
+		t = x[2];
+		x[2] = sse2_rot (x[3], 11);
+		x[3] = sse2_rot (t, 11);
+		for (i = 0; i < 4; ++i) {
+			x[i] = _mm_xor_si128 (x[i], x[i + 4]);
+			x[i + 4] = _mm_shuffle_epi32 (x[i + 4], 0xb1);
+		}
+	}
+
+	for (i = 0; i < 8; ++i) _mm_storeu_si128 ( (__m128i*) (X + 4 * i), x[i]);
+}
+
+#define avx2_rot(v,b) \
+	_mm256_or_si256 (_mm256_slli_epi32 (v, b), _mm256_srli_epi32 (v, 32 - (b)))
+
+CCR_TARGET ("avx2")
+static void cubehash_rounds_avx2 (uint32_t*X, uint n)
+{
+	__m256i x0, x1, x2, x3, t;
+
+	x0 = _mm256_loadu_si256 ( (__m256i*) X);
+	x1 = _mm256_loadu_si256 ( (__m256i*) (X + 8));
+	x2 = _mm256_loadu_si256 ( (__m256i*) (X + 16));
+	x3 = _mm256_loadu_si256 ( (__m256i*) (X + 24));
+
+	for (; n; --n) {
+		x2 = _mm256_add_epi32 (x2, x0);
+		x3 = _mm256_add_epi32 (x3, x1);
+		t = x0;
+		x0 = avx2_rot (x1, 7);
+		x1 = avx2_rot (t, 7);
+		x0 = _mm256_xor_si256 (x0, x2);
+		x1 = _mm256_xor_si256 (x1, x3);
+		x2 = _mm256_shuffle_epi32 (x2, 0x4e);
+		x3 = _mm256_shuffle_epi32 (x3, 0x4e);
+		x2 = _mm256_add_epi32 (x2, x0);
+		x3 = _mm256_add_epi32 (x3, x1);
+		x0 = _mm256_permute4x64_epi64 (x0, 0x4e);
+		x1 = _mm256_permute4x64_epi64 (x1, 0x4e);
+		x0 = avx2_rot (x0, 11);
+		x1 = avx2_rot (x1, 11);
+		x0 = _mm256_xor_si256 (x0, x2);
+		x1 = _mm256_xor_si256 (x1, x3);
+		x2 = _mm256_shuffle_epi32 (x2, 0xb1);
+		x3 = _mm256_shuffle_epi32 (x3, 0xb1);
+	}
+
+	_mm256_storeu_si256 ( (__m256i*) X, x0);
+	_mm256_storeu_si256 ( (__m256i*) (X + 8), x1);
+	_mm256_storeu_si256 ( (__m256i*) (X + 16), x2);
+	_mm256_storeu_si256 ( (__m256i*) (X + 24), x3);
+}
+
+/*
+ * Interleaved variants keep state word w of lane l in X[w * lanes + l], so
+ * each vector holds the same word of all lanes and the round is the scalar
+ * round on vectors. Once the loops are unrolled, the index permutations only
+ * rename registers.
+ *
+ * There is no 8-lane AVX2 variant: 32 state vectors do not fit into 16
+ * registers, and the spilling version was measured slower than running the
+ * single-state AVX2 rounds above on one input after another.
+ */
+
+#define u16(cmd) _Pragma ("GCC unroll 16") for(i=0;i<16;++i) cmd;
+
+#define lanes_round(ADD,XOR,ROT) do { \
+	u16 (x[i + 16] = ADD (x[i + 16], x[i])); \
+	u16 (t[i ^ 8] = x[i]); \
+	u16 (x[i] = ROT (t[i], 7)); \
+	u16 (x[i] = XOR (x[i], x[i + 16])); \
+	u16 (t[i ^ 2] = x[i + 16]); \
+	u16 (x[i + 16] = t[i]); \
+	u16 (x[i + 16] = ADD (x[i + 16], x[i])); \
+	u16 (t[i ^ 4] = x[i]); \
+	u16 (x[i] = ROT (t[i], 11)); \
+	u16 (x[i] = XOR (x[i], x[i + 16])); \
+	u16 (t[i ^ 1] = x[i + 16]); \
+	u16 (x[i + 16] = t[i]); } while (0)
+
+CCR_TARGET ("sse2")
+static void cubehash_rounds_4 (uint32_t*X, uint n)
+{
+	int i;
+	__m128i x[32], t[16];
+
+	for (i = 0; i < 32; ++i) x[i] = _mm_loadu_si128 ( (__m128i*) (X + 4 * i));
+	for (; n; --n) lanes_round (_mm_add_epi32, _mm_xor_si128, sse2_rot);
+	for (i = 0; i < 32; ++i) _mm_storeu_si128 ( (__m128i*) (X + 4 * i), x[i]);
+}
+
+//masked rotation avoids GCC's maybe-uninitialized warning on plain form
+#define avx512_rot(v,b) _mm512_maskz_rol_epi32 (0xffff, v, b)
+
+CCR_TARGET ("avx512f")
+static void cubehash_rounds_16 (uint32_t*X, uint n)
+{
+	int i;
+	__m512i x[32], t[16];
+
+	for (i = 0; i < 32; ++i) x[i] = _mm512_loadu_si512 (X + 16 * i);
+	for (; n; --n)
+		lanes_round (_mm512_add_epi32, _mm512_xor_si512, avx512_rot);
+	for (i = 0; i < 32; ++i) _mm512_storeu_si512 (X + 16 * i, x[i]);
+}
+
+#endif //CCR_X86_SIMD
+
+//lane count for n remaining inputs, 1 if it's not worth it
+static uint cubehash_lanes (size_t n)
+{
+#if CCR_X86_SIMD
+	static bool avx512 = cpu_has_avx512(), avx2 = cpu_has_avx2(),
+	            sse2 = cpu_has_sse2();
+	if (avx512 && n >= 16) return 16;
+	if (!avx2 && sse2 && n >= 4) return 4;
+#endif
+	return 1;
+}
+
+static void cubehash_rounds_lanes (uint32_t*X, uint lanes, uint n)
+{
+#if CCR_X86_SIMD
+	switch (lanes) {
+	case 16:
+		cubehash_rounds_16 (X, n);
+		return;
+	case 4:
+		cubehash_rounds_4 (X, n);
+		return;
+	}
+#endif
+	cubehash_rounds (X, n);
+}
+
+//xor n bytes of data into one lane of the state
+static void cubehash_lane_xor (uint32_t*X, uint lanes,
+                               const byte*data, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		X[ (i / 4) * lanes] ^= ( (uint32_t) (data[i])) << ( (i % 4) * 8);
+}
+
+void cubehash_many (const uint32_t*iv, uint R, uint B, uint F, uint H,
+                    const byte*in, size_t len, size_t n, byte*out)
+{
+	uint32_t X[32 * 16];
+	uint L, l, i;
+	size_t pos;
+
+	for (; n; n -= L, in += L * len, out += L * H) {
+		L = cubehash_lanes (n);
+
+		for (i = 0; i < 32; ++i)
+			for (l = 0; l < L; ++l) X[i * L + l] = iv[i];
+
+		for (pos = 0; pos + B <= len; pos += B) {
+			for (l = 0; l < L; ++l)
+				cubehash_lane_xor (X + l, L, in + l * len + pos, B);
+			cubehash_rounds_lanes (X, L, R);
+		}
+
+		//the final incomplete block with padding
+		for (l = 0; l < L; ++l) {
+			cubehash_lane_xor (X + l, L, in + l * len + pos, len - pos);
+			X[ ( (len - pos) / 4) * L + l] ^=
+			    ( (uint32_t) 0x80) << ( ( (len - pos) % 4) * 8);
+		}
+		cubehash_rounds_lanes (X, L, R);
+
+		//finalize
+		for (l = 0; l < L; ++l) X[31 * L + l] ^= 1;
+		cubehash_rounds_lanes (X, L, F);
+
+		for (l = 0; l < L; ++l)
+			for (i = 0; i < H; ++i)
+				out[l * H + i] =
+				    (X[ (i / 4) * L + l] >> ( (i % 4) * 8)) & 0xff;
+	}
+}
+
+void cubehash_rounds (uint32_t*X, uint n)
+{
+#if CCR_X86_SIMD
+	static void (*kernel) (uint32_t*, uint) =
+	    cpu_has_avx2() ? cubehash_rounds_avx2 :
+	    cpu_has_sse2() ? cubehash_rounds_sse2 :
+	    cubehash_rounds_generic;
+	kernel (X, n);
+#else
+	cubehash_rounds_generic (X, n);
+#endif
+}
@@ -24,9 +24,17 @@
 #include "types.h"
 
 #include <stdint.h>
+#include <stddef.h>
 
-#define ROT(a,b,n) (((a) << (b)) | ((a) >> (n - b)))
-#define i16(cmd) for(i=0;i<16;++i) cmd;
+//n CubeHash rounds on the 32-word state, vectorized where the CPU allows
+void cubehash_rounds (uint32_t*X, uint n);
+
+/*
+ * hashes n inputs of len bytes (stored one after another) with several
+ * states interleaved in vector lanes. iv is the initialized state.
+ */
+void cubehash_many (const uint32_t*iv, uint R, uint B, uint F, uint H,
+                    const byte*in, size_t len, size_t n, byte*out);
 
 template < int I, //initialization rounds
            int R, //rounds
@@ -38,43 +46,26 @@ class cubehash_state
 	uint32_t X[32]; //the state
 
 	inline void rounds (uint n) {
-		int i;
-		uint32_t T[16];
-		for (; n; --n) {
-			i16 (X[i + 16] += X[i]);
-			i16 (T[i ^ 8] = X[i]);
-			i16 (X[i] = ROT (T[i], 7, 32));
-			i16 (X[i] ^= X[i + 16]);
-			i16 (T[i ^ 2] = X[i + 16]);
-			i16 (X[i + 16] = T[i]);
-			i16 (X[i + 16] += X[i]);
-			i16 (T[i ^ 4] = X[i]);
-			i16 (X[i] = ROT (T[i], 11, 32));
-			i16 (X[i] ^= X[i + 16]);
-			i16 (T[i ^ 1] = X[i + 16]);
-			i16 (X[i + 16] = T[i]);
-		}
+		cubehash_rounds (X, n);
 	}
 
-public:
-	inline void init() {
-		static bool iv_init = false;
-		static uint32_t IV[32];
-		int i;
+	//the initial state, computed on first use (thread-safely)
+	struct iv_state {
+		uint32_t X[32];
 
-		if (iv_init) {
-			for (i = 0; i < 32; ++i) X[i] = IV[i];
-			return;
+		iv_state() {
+			X[0] = H;
+			X[1] = B;
+			X[2] = R;
+			for (int i = 3; i < 32; ++i) X[i] = 0;
+			cubehash_rounds (X, I);
 		}
+	};
 
-		X[0] = H;
-		X[1] = B;
-		X[2] = R;
-		for (i = 3; i < 32; ++i) X[i] = 0;
-		rounds (I);
-
-		for (i = 0; i < 32; ++i) IV[i] = X[i];
-		iv_init = true;
+public:
+	inline void init() {
+		static const iv_state iv;
+		for (int i = 0; i < 32; ++i) X[i] = iv.X[i];
 	}
 
 	void process_block (const byte*data) {
@@ -123,6 +114,11 @@ public:
 		rounds (F);
 	}
 
+	//the raw state, for starting the interleaved states
+	const uint32_t* state() const {
+		return X;
+	}
+
 	void get_hash (byte*out) {
 		for (int i = 0; i < H; ++i)
 			out[i] = (X[i / 4] >> ( (i % 4) * 8)) & 0xff;
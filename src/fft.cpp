@@ -24,50 +24,95 @@
 #include <fftw3.h>
 #include <math.h>
 
+#include <map>
+#include <mutex>
+
 /*
  * FFTW wraparound for performing fast multiplication of cyclic matrices.
  *
- * It would probably be cool to save wisdom manually or generate better plans,
- * but since we're usually doing less than 10 FFTs for each run of codecrypt,
- * the thing doesn't pay off. Feel free to implement it.
+ * Plans are created once for each size and direction and kept for the whole
+ * run (execution of a plan on new arrays is thread-safe, planning is not, so
+ * it goes under a lock). Planning is FFTW_ESTIMATE by default; FFTW_MEASURE
+ * takes seconds per size and is only worth it for long batch runs, ideally
+ * with the wisdom saved to a file.
  */
 
-#include "iohelpers.h"
+static std::mutex plan_mutex;
+static std::map<std::pair<int, int>, fftw_plan> plan_cache;
+static bool plan_measure = false;
+
+void fft_set_measure (bool measure)
+{
+	std::lock_guard<std::mutex> lock (plan_mutex);
+	plan_measure = measure;
+}
+
+bool fft_import_wisdom (const std::string&filename)
+{
+	std::lock_guard<std::mutex> lock (plan_mutex);
+	return fftw_import_wisdom_from_filename (filename.c_str());
+}
+
+bool fft_export_wisdom (const std::string&filename)
+{
+	std::lock_guard<std::mutex> lock (plan_mutex);
+	return fftw_export_wisdom_to_filename (filename.c_str());
+}
 
-void fft (bool forward, std::vector<dcx>&in, std::vector<dcx>&out)
+//plan kinds
+#define PLAN_R2C 0
+#define PLAN_C2R 1
+
+static fftw_plan get_plan (int n, int kind)
 {
-	fftw_plan p;
-	out.resize (in.size(), dcx (0, 0));
-
-	p = fftw_plan_dft_1d (in.size(),
-	                      //Cin, Cout,
-	                      reinterpret_cast<fftw_complex*> (in.data()),
-	                      reinterpret_cast<fftw_complex*> (out.data()),
-	                      forward ? FFTW_FORWARD : FFTW_BACKWARD,
-	                      FFTW_ESTIMATE);
-
-	if (!forward)
-		for (size_t i = 0; i < out.size(); ++i)
-			out[i] /= (double) out.size();
-
-	fftw_execute (p);
-	fftw_destroy_plan (p);
+	std::lock_guard<std::mutex> lock (plan_mutex);
+	fftw_plan&p = plan_cache[std::make_pair (n, kind)];
+	if (p) return p;
+
+	//measuring overwrites the arrays, plan on scratch ones
+	unsigned flags = FFTW_UNALIGNED |
+	                 (plan_measure ? FFTW_MEASURE : FFTW_ESTIMATE);
+	fftw_complex*c = fftw_alloc_complex (n / 2 + 1);
+	double*r = fftw_alloc_real (n);
+
+	if (kind == PLAN_R2C) p = fftw_plan_dft_r2c_1d (n, r, c, flags);
+	else p = fftw_plan_dft_c2r_1d (n, c, r, flags);
+
+	fftw_free (c);
+	fftw_free (r);
+	return p;
 }
 
-void fft (bvector&inb, std::vector<dcx>&out)
+#include "iohelpers.h"
+
+/*
+ * Real transforms. Spectra of real vectors are symmetric, so only n/2+1
+ * coefficients are computed. The inverse is not normalized; for odd n that
+ * doesn't change the parity of the result.
+ */
+
+void fft (const bvector&in, std::vector<dcx>&out, fft_workspace&ws)
 {
-	std::vector<dcx> in;
-	in.resize (inb.size(), dcx (0, 0));
-	for (size_t i = 0; i < inb.size(); ++i) if (inb[i]) in[i] = dcx (1, 0);
-	fft (true, in, out);
+	size_t n = in.size();
+	ws.r.resize (n);
+	for (size_t i = 0; i < n; ++i) ws.r[i] = in.get (i) ? 1 : 0;
+
+	out.resize (n / 2 + 1);
+	fftw_execute_dft_r2c (get_plan (n, PLAN_R2C), ws.r.data(),
+	                      reinterpret_cast<fftw_complex*> (out.data()));
 }
 
-void fft (std::vector<dcx>&in, bvector&outb)
+void fft (const std::vector<dcx>&in, size_t n, bvector&out, fft_workspace&ws)
 {
-	std::vector<dcx> out;
-	fft (false, in, out);
-	outb.resize (out.size());
-	outb.fill_zeros();
-	for (size_t i = 0; i < out.size(); ++i)
-		if (1 & (int) round (out[i].real())) outb[i] = 1;
+	//c2r destroys its input
+	ws.c.assign (in.begin(), in.end());
+	ws.r.resize (n);
+	fftw_execute_dft_c2r (get_plan (n, PLAN_C2R),
+	                      reinterpret_cast<fftw_complex*> (ws.c.data()),
+	                      ws.r.data());
+
+	out.resize (n);
+	out.fill_zeros();
+	for (size_t i = 0; i < n; ++i)
+		if (1 & (long) round (ws.r[i])) out.set (i);
 }
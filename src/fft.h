@@ -23,12 +23,30 @@
 
 #include "bvector.h"
 #include <complex>
+#include <string>
 
 typedef std::complex<double> dcx;
-void fft (bool forward, std::vector<dcx>&in, std::vector<dcx>&out);
 
-//direct conversion from/to GF(2)
-void fft (bvector&in, std::vector<dcx>&out);
-void fft (std::vector<dcx>&in, bvector&out);
+/*
+ * transforms from/to GF(2) vectors through real-to-complex FFT, spectra
+ * have only n/2+1 coefficients. The workspace keeps the scratch buffers
+ * between calls.
+ */
+class fft_workspace
+{
+public:
+	std::vector<double> r;
+	std::vector<dcx> c;
+};
+
+void fft (const bvector&in, std::vector<dcx>&out, fft_workspace&);
+void fft (const std::vector<dcx>&in, size_t n, bvector&out, fft_workspace&);
+
+//plan with FFTW_MEASURE (affects only sizes that weren't planned yet)
+void fft_set_measure (bool);
+
+//FFTW wisdom (i.e. the measured plans) persistence
+bool fft_import_wisdom (const std::string&filename);
+bool fft_export_wisdom (const std::string&filename);
 
 #endif
@@ -20,6 +20,8 @@
 
 #include "fmtseq.h"
 
+#include "threadpool.h"
+
 using namespace fmtseq;
 
 void prepare_keygen (streamcipher& kg, const std::vector<byte>&SK, uint idx)
@@ -51,6 +53,53 @@ static void add_zero_checksum (bvector& v)
 	}
 }
 
+/*
+ * Generates all private commitments of a leaf to x and the concatenated
+ * public commitments to Y. The commitments are independent, so they are
+ * hashed all at once.
+ */
+static void commit_leaf (streamcipher&generator, hash_func&hf,
+                         uint commitments,
+                         std::vector<byte>&x, std::vector<byte>&Y)
+{
+	x.resize (commitments * hf.size());
+	Y.resize (x.size());
+	generator.gen (x.size(), x.data());
+	hf.hash_many (x.data(), hf.size(), commitments, Y.data());
+}
+
+//pushes the hash of Y to the stack as a new leaf
+static void push_leaf (std::vector<privkey::tree_stk_item>&stk, uint pos,
+                       hash_func&hf, const std::vector<byte>&Y)
+{
+	stk.push_back (privkey::tree_stk_item (0, pos, std::vector<byte>()));
+	std::vector<byte>&item = stk.back().item;
+	item.resize (hf.size());
+	hf.hash (Y.data(), Y.size(), item.data());
+}
+
+/*
+ * If two topmost stack items are on the same level, replace them with their
+ * parent (stored over the left one) and return true.
+ */
+static bool squash_stack (std::vector<privkey::tree_stk_item>&stk,
+                          hash_func&hf, std::vector<byte>&Y)
+{
+	if (stk.size() < 2) return false;
+
+	privkey::tree_stk_item&a = * (stk.end() - 2), &b = stk.back();
+	if (a.level != b.level) return false;
+
+	Y.clear();
+	Y.insert (Y.end(), a.item.begin(), a.item.end());
+	Y.insert (Y.end(), b.item.begin(), b.item.end());
+	a.level = b.level + 1;
+	a.pos = b.pos / 2;
+	hf.hash (Y.data(), Y.size(), a.item.data());
+	stk.pop_back();
+	return true;
+}
+
 static void alloc_exist (privkey&priv)
 {
 	priv.exist.resize (priv.l);
@@ -131,11 +180,45 @@ static bool check_privkey (privkey&priv, hash_func&hf)
 	return true;
 }
 
+/*
+ * computes the next leaf of i-th desired subtree and squashes its stack.
+ * Returns false if the subtree is already complete.
+ */
+static bool desired_step (privkey&priv, uint i,
+                          hash_func&hf, streamcipher&generator,
+                          std::vector<byte>&x, std::vector<byte>&Y)
+{
+	uint d_h = (i + 1) * priv.h;
+	uint d_leaves = 1 << d_h;
+	if (priv.desired_progress[i] >= d_leaves)
+		return false; //already done
+
+	//create the leaf
+	uint d_startpos = (1 + (priv.sigs_used >> d_h)) << d_h;
+	uint leafid = d_startpos + priv.desired_progress[i];
+
+	prepare_keygen (generator, priv.SK, leafid);
+	commit_leaf (generator, hf, fmtseq_commitments (priv.hs), x, Y);
+
+	std::vector<privkey::tree_stk_item>
+	&stk = priv.desired_stack[i];
+
+	push_leaf (stk, priv.desired_progress[i], hf, Y);
+	store_desired (priv, i, stk.back());
+
+	++priv.desired_progress[i];
+
+	//stack squashing
+	while (squash_stack (stk, hf, Y))
+		store_desired (priv, i, stk.back());
+
+	return true;
+}
+
 static void update_privkey (privkey&priv, hash_func&hf, streamcipher&generator)
 {
-	uint i, j;
+	uint i;
 	std::vector<byte> x, Y;
-	uint commitments = fmtseq_commitments (priv.hs);
 
 	/*
 	 * Perform one calculation step on all subtrees.
@@ -161,62 +244,13 @@ static void update_privkey (privkey&priv, hash_func&hf, streamcipher&generator)
 	 * every round (e.g. 2 times stack squashing, or gen, gen, or
 	 * gen/squash...) This brings equivalent speed for all signatures (all
 	 * do exactly 2 operations), but storage of internal state and the
-	 * whole algorithm is kindof complex. Omitted for simplicity.
+	 * whole algorithm is kindof complex. Omitted for simplicity. Users
+	 * who need flat signing latency can run privkey::precompute between
+	 * the signatures instead, which leaves only the cheap part here.
 	 */
 
-	x.resize (hf.size());
-
-	uint d_leaves, d_startpos, d_h;
-	for (i = 0; i < priv.desired.size(); ++i) {
-		d_h = (i + 1) * priv.h;
-		d_leaves = 1 << d_h;
-		if (priv.desired_progress[i] >= d_leaves)
-			continue; //already done
-
-		//create the leaf
-		d_startpos = (1 + (priv.sigs_used >> d_h)) << d_h;
-		uint leafid = d_startpos + priv.desired_progress[i];
-
-		prepare_keygen (generator, priv.SK, leafid);
-		Y.clear();
-		for (j = 0; j < commitments; ++j) {
-			generator.gen (hf.size(), & (x[0]));
-			x = hf (x);
-			Y.insert (Y.end(), x.begin(), x.end());
-		}
-
-
-		std::vector<privkey::tree_stk_item>
-		&stk = priv.desired_stack[i];
-
-		stk.push_back (privkey::tree_stk_item
-		               (0, priv.desired_progress[i], hf (Y)));
-		store_desired (priv, i, stk.back());
-
-		++priv.desired_progress[i];
-
-		//stack squashing
-		for (;;) {
-			if (stk.size() < 2) break;
-			if ( (stk.end() - 1)->level !=
-			     (stk.end() - 2)->level) break;
-
-			Y.clear();
-			Y.insert (Y.end(),
-			          (stk.end() - 2)->item.begin(),
-			          (stk.end() - 2)->item.end());
-			Y.insert (Y.end(),
-			          (stk.end() - 1)->item.begin(),
-			          (stk.end() - 1)->item.end());
-			uint l = stk.back().level + 1;
-			uint p = stk.back().pos / 2;
-			stk.pop_back();
-			stk.pop_back();
-			stk.push_back (privkey::tree_stk_item
-			               (l, p, hf (Y)));
-			store_desired (priv, i, stk.back());
-		}
-	}
+	for (i = 0; i < priv.desired.size(); ++i)
+		desired_step (priv, i, hf, generator, x, Y);
 
 	//where needed, move desired to exist and reset or erase
 	uint next_sigs_used = priv.sigs_used + 1;
@@ -260,11 +294,9 @@ static void update_privkey (privkey&priv, hash_func&hf, streamcipher&generator)
  * Key generator
  */
 
-int fmtseq::generate (pubkey&pub, privkey&priv,
-                      prng&rng, hash_func&hf, streamcipher&generator,
-                      uint hs, uint h, uint l)
+static void keygen_start (privkey&priv, prng&rng, uint hs, uint h, uint l)
 {
-	uint i, j;
+	uint i;
 
 	/*
 	 * first off, generate a secret key for commitment generator.
@@ -282,62 +314,98 @@ int fmtseq::generate (pubkey&pub, privkey&priv,
 	priv.hs = hs;
 	priv.sigs_used = 0;
 
-	std::vector<privkey::tree_stk_item> stk;
-	stk.reserve (h * l + 1);
-
-	uint sigs = 1 << (h * l);
-
-	uint commitments = fmtseq_commitments (hs);
+	alloc_exist (priv);
+}
 
+/*
+ * computes leaves from..to-1, squashing them on the stack and filling in the
+ * exist trees. Different leaf ranges store to different parts of exist.
+ */
+static void keygen_leaves (privkey&priv, hash_func&hf, streamcipher&generator,
+                           uint from, uint to,
+                           std::vector<privkey::tree_stk_item>&stk)
+{
+	uint commitments = fmtseq_commitments (priv.hs);
 	std::vector<byte> x, Y;
-	x.resize (hf.size());
-
-	alloc_exist (priv);
 
-	for (i = 0; i < sigs; ++i) {
+	for (uint i = from; i < to; ++i) {
 		//generate commitments and concat publics into Y
-		Y.clear();
-		Y.reserve (commitments * hf.size());
 		prepare_keygen (generator, priv.SK, i);
-		for (j = 0; j < commitments; ++j) {
-			generator.gen (hf.size(), & (x[0]));
-			x = hf (x);
-			Y.insert (Y.end(), x.begin(), x.end());
-		}
+		commit_leaf (generator, hf, commitments, x, Y);
 
-		stk.push_back (privkey::tree_stk_item (0, i, hf (Y)));
+		push_leaf (stk, i, hf, Y);
 		store_exist (priv, stk.back());
 
 		//try squashing the stack
-		for (;;) {
-			if (stk.size() < 2) break;
-			if ( (stk.end() - 1)->level !=
-			     (stk.end() - 2)->level) break;
-
-			Y.clear();
-			Y.insert (Y.end(),
-			          (stk.end() - 2)->item.begin(),
-			          (stk.end() - 2)->item.end());
-			Y.insert (Y.end(),
-			          (stk.end() - 1)->item.begin(),
-			          (stk.end() - 1)->item.end());
-			uint l = stk.back().level + 1;
-			uint p = stk.back().pos / 2;
-			stk.pop_back();
-			stk.pop_back();
-			stk.push_back (privkey::tree_stk_item
-			               (l, p, hf (Y)));
+		while (squash_stack (stk, hf, Y))
 			store_exist (priv, stk.back());
-		}
 	}
+}
 
+static void keygen_finish (pubkey&pub, privkey&priv, hash_func&hf,
+                           std::vector<privkey::tree_stk_item>&stk)
+{
 	alloc_desired (priv, hf);
 
 	//now there's the public verification key available in the stack.
 	pub.check = stk.back().item;
-	pub.H = h * l;
-	pub.hs = hs;
+	pub.H = priv.h * priv.l;
+	pub.hs = priv.hs;
+}
+
+int fmtseq::generate (pubkey&pub, privkey&priv,
+                      prng&rng, hash_func&hf, streamcipher&generator,
+                      uint hs, uint h, uint l)
+{
+	keygen_start (priv, rng, hs, h, l);
+
+	std::vector<privkey::tree_stk_item> stk;
+	stk.reserve (h * l + 1);
+	keygen_leaves (priv, hf, generator, 0, 1 << (h * l), stk);
+
+	keygen_finish (pub, priv, hf, stk);
+	return 0;
+}
+
+int fmtseq::generate (pubkey&pub, privkey&priv, prng&rng,
+                      factoryof<hash_func>&hff, factoryof<streamcipher>&scf,
+                      uint hs, uint h, uint l, thread_pool&pool)
+{
+	keygen_start (priv, rng, hs, h, l);
+
+	//split the leaves to enough subtrees to keep all threads busy
+	uint H = h * l, k = 0;
+	while (k < H && ( (size_t) 1 << k) < 4 * pool.size()) ++k;
+	uint subtrees = 1 << k, leaves = 1 << (H - k);
+
+	std::vector<privkey::tree_stk_item> roots (subtrees);
+	pool.run (subtrees, [&] (size_t i) {
+		instanceof<hash_func> hf (hff.get());
+		instanceof<streamcipher> generator (scf.get());
+		hf.collect();
+		generator.collect();
+
+		std::vector<privkey::tree_stk_item> stk;
+		stk.reserve (H - k + 1);
+		keygen_leaves (priv, *hf, *generator,
+		               i * leaves, (i + 1) * leaves, stk);
+		roots[i] = stk.back();
+	});
+
+	//subtree roots are squashed to the top just as the leaves would be
+	instanceof<hash_func> hf (hff.get());
+	hf.collect();
+
+	std::vector<privkey::tree_stk_item> stk;
+	std::vector<byte> Y;
+	stk.reserve (k + 1);
+	for (uint i = 0; i < subtrees; ++i) {
+		stk.push_back (roots[i]);
+		while (squash_stack (stk, *hf, Y))
+			store_exist (priv, stk.back());
+	}
 
+	keygen_finish (pub, priv, *hf, stk);
 	return 0;
 }
 
@@ -380,24 +448,29 @@ int privkey::sign (const bvector& hash, bvector& sig, hash_func& hf,
 	bvector M2 = hash;
 	add_zero_checksum (M2);
 
-	std::vector<byte> Sig, t;
-	uint i;
-
-	t.resize (hf.size());
+	std::vector<byte> Sig, t, y;
+	std::vector<uint> ys;
+	uint i, j, hsz = hf.size();
 
-	Sig.reserve (hf.size() * (commitments + h * l));
-	//first, compute the commitments and push them to the signature
+	Sig.reserve (hsz * (commitments + h * l));
+	//first, generate all x_i to the signature
 	prepare_keygen (generator, SK, sigs_used);
-	for (i = 0; i < commitments; ++i) {
-		//generate x_i
-		generator.gen (hf.size(), & (t[0]));
-
-		//if it's 0, publish y_i, else publish x_i
-		if (!M2[i]) t = hf (t);
-
-		//append it to signature
-		Sig.insert (Sig.end(), t.begin(), t.end());
-	}
+	Sig.resize (hsz * commitments);
+	generator.gen (Sig.size(), Sig.data());
+
+	//where it's 0, publish y_i instead of x_i (hashed all at once)
+	t.reserve (Sig.size());
+	ys.reserve (commitments);
+	for (i = 0; i < commitments; ++i) if (!M2[i]) {
+			t.insert (t.end(), Sig.begin() + i * hsz,
+			          Sig.begin() + (i + 1) * hsz);
+			ys.push_back (i);
+		}
+	y.resize (t.size());
+	hf.hash_many (t.data(), hsz, ys.size(), y.data());
+	for (i = 0; i < ys.size(); ++i)
+		for (j = 0; j < hsz; ++j)
+			Sig[ys[i] * hsz + j] = y[i * hsz + j];
 
 	//now retrieve the authentication path
 	uint pos = sigs_used;
@@ -446,6 +519,53 @@ int privkey::sign (const bvector& hash, bvector& sig, hash_func& hf,
 	return 0;
 }
 
+/*
+ * Precomputation of desired subtrees ahead of signing. Desired subtree
+ * contents depend only on the current exist subtree, so computing leaves
+ * earlier than update_privkey would gives exactly the same key.
+ */
+
+uint privkey::precompute_pending()
+{
+	uint i, r = 0;
+	for (i = 0; i < desired.size() && i < desired_progress.size(); ++i) {
+		uint d_leaves = 1 << ( (i + 1) * h);
+		if (desired_progress[i] < d_leaves)
+			r += d_leaves - desired_progress[i];
+	}
+	return r;
+}
+
+uint privkey::precompute (hash_func&hf, streamcipher&generator, uint steps)
+{
+	if (!check_privkey (*this, hf)) return 0;
+
+	std::vector<byte> x, Y;
+	uint done;
+	for (done = 0; done < steps; ++done) {
+		/*
+		 * advance the subtree that would be needed first, i.e. the
+		 * one with the least leaves computed ahead of signatures.
+		 */
+		uint i, best = 0, best_ahead = 0;
+		bool found = false;
+		for (i = 0; i < desired.size(); ++i) {
+			uint d_h = (i + 1) * h, d_leaves = 1 << d_h;
+			if (desired_progress[i] >= d_leaves) continue;
+			uint ahead = desired_progress[i]
+			             - (sigs_used & (d_leaves - 1));
+			if (!found || ahead < best_ahead) {
+				best = i;
+				best_ahead = ahead;
+				found = true;
+			}
+		}
+		if (!found) break;
+		desired_step (*this, best, hf, generator, x, Y);
+	}
+	return done;
+}
+
 int pubkey::verify (const bvector& sig, const bvector& hash, hash_func& hf)
 {
 	uint i, j;
@@ -463,42 +583,47 @@ int pubkey::verify (const bvector& sig, const bvector& hash, hash_func& hf)
 	for (i = sig.size() - 1; i >= (commitments + H) * hf.size() * 8; --i)
 		sig_no = (sig_no << 1) + (sig[i] ? 1 : 0);
 
-	std::vector<byte> t, Y;
-	std::vector<std::vector<byte> > Sig;
-
-	//split and convert to byte form for convenient hashing
-	Sig.resize (commitments + H);
-	for (i = 0; i < (commitments + H); ++i) {
-		Sig[i].resize (hf.size(), 0);
-		for (j = 0; j < hf.size() * 8; ++j)
-			if (sig[j + i * hf.size() * 8])
-				Sig[i][j / 8] |= (1 << (j % 8));
-	}
-
-	Y.clear();
-	for (i = 0; i < commitments; ++i) {
-		if (M2[i]) t = hf (Sig[i]); //convert pk_i to sk_i at 1's
-		else t = Sig[i]; //else it should already be pk_i
-		Y.insert (Y.end(), t.begin(), t.end());  //append it to Y_i
-	}
+	uint hsz = hf.size();
+	std::vector<byte> Sig, t, Y;
+	std::vector<uint> xs;
+
+	//convert to byte form for convenient hashing, i-th hash is at i*hsz
+	Sig.resize ( (commitments + H) * hsz, 0);
+	for (i = 0; i < Sig.size() * 8; ++i)
+		if (sig[i]) Sig[i / 8] |= (1 << (i % 8));
+
+	//convert sk_i to pk_i at 1's, all at once; else it should be pk_i
+	Y.reserve (commitments * hsz);
+	xs.reserve (commitments);
+	for (i = 0; i < commitments; ++i) if (M2[i]) {
+			Y.insert (Y.end(), Sig.begin() + i * hsz,
+			          Sig.begin() + (i + 1) * hsz);
+			xs.push_back (i);
+		}
+	t.resize (Y.size());
+	hf.hash_many (Y.data(), hsz, xs.size(), t.data());
+	for (i = 0; i < xs.size(); ++i)
+		for (j = 0; j < hsz; ++j)
+			Sig[xs[i] * hsz + j] = t[i * hsz + j];
 
-	//create the leaf
-	t = hf (Y);
+	//create the leaf from all Y_i
+	t.resize (hsz);
+	hf.hash (Sig.data(), commitments * hsz, t.data());
 
 	//walk the authentication path
 	for (i = 0; i < H; ++i) {
+		const byte*p = Sig.data() + (commitments + i) * hsz;
 		Y.clear();
-		Y = Sig[commitments + i];
 		if ( (sig_no >> i) & 1) {
 			//append path auth from left
+			Y.insert (Y.end(), p, p + hsz);
 			Y.insert (Y.end(), t.begin(), t.end());
-			t = hf (Y);
 		} else {
 			//append from right
-			t.insert (t.end(), Y.begin(), Y.end());
-			t = hf (t);
+			Y.insert (Y.end(), t.begin(), t.end());
+			Y.insert (Y.end(), p, p + hsz);
 		}
-
+		hf.hash (Y.data(), Y.size(), t.data());
 	}
 
 	if (t == check) return 0; //all went okay
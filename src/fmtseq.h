@@ -29,6 +29,9 @@
 #include "hash.h"
 #include "prng.h"
 #include "sc.h"
+#include "factoryof.h"
+
+class thread_pool;
 
 /*
  * FMTseq - Merkle signatures with fractal tree traversal, using original
@@ -75,6 +78,15 @@ public:
 
 	int sign (const bvector&, bvector&, hash_func&, streamcipher&);
 
+	/*
+	 * computes up to `steps' leaves of the desired subtrees ahead of time,
+	 * so that following signatures don't have to. Can be called between
+	 * signatures (not concurrently with sign). Returns the number of
+	 * leaves computed, 0 when there's nothing left to precompute.
+	 */
+	uint precompute (hash_func&, streamcipher&, uint steps);
+	uint precompute_pending();
+
 	uint sigs_remaining() {
 		return (1 << (h * l)) - sigs_used;
 	}
@@ -114,6 +126,14 @@ public:
 
 int generate (pubkey&, privkey&, prng&, hash_func&, streamcipher&,
               uint hs, uint h, uint l);
+
+/*
+ * parallel version, subtrees of leaves are computed in the pool, each with
+ * own hash and generator instances. Gives the same key as the serial one.
+ */
+int generate (pubkey&, privkey&, prng&,
+              factoryof<hash_func>&, factoryof<streamcipher>&,
+              uint hs, uint h, uint l, thread_pool&);
 }
 
 #endif
@@ -0,0 +1,234 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gf2x.h"
+
+#include <vector>
+
+#include "simd.h"
+
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * 8x8-word (512x512 bit) schoolbook kernels, the base case of Karatsuba.
+ * All write the whole 16-word result.
+ */
+
+#define GF2X_BASE 8
+
+static void mul8_generic (const uint64_t*a, const uint64_t*b, uint64_t*r)
+{
+	int i, j, k;
+	for (i = 0; i < 2 * GF2X_BASE; ++i) r[i] = 0;
+
+	for (i = 0; i < GF2X_BASE; ++i)
+		for (j = 0; j < GF2X_BASE; ++j) {
+			uint64_t lo = 0, hi = 0, x = a[i], y = b[j];
+			//branch-free, so that this doesn't leak the operands
+			lo = y & - (x & 1);
+			for (k = 1; k < 64; ++k) {
+				uint64_t m = - ( (x >> k) & 1);
+				lo ^= (y << k) & m;
+				hi ^= (y >> (64 - k)) & m;
+			}
+			r[i + j] ^= lo;
+			r[i + j + 1] ^= hi;
+		}
+}
+
+#if CCR_X86_SIMD
+
+CCR_TARGET ("pclmul,sse2")
+static void mul8_pclmul (const uint64_t*a, const uint64_t*b, uint64_t*r)
+{
+	int i, j;
+	for (i = 0; i < 2 * GF2X_BASE; ++i) r[i] = 0;
+
+	for (i = 0; i < GF2X_BASE; ++i) {
+		__m128i x = _mm_set_epi64x (0, a[i]);
+		for (j = 0; j < GF2X_BASE; ++j) {
+			__m128i y = _mm_set_epi64x (0, b[j]),
+			        *o = (__m128i*) (r + i + j);
+			_mm_storeu_si128 (o, _mm_xor_si128 (_mm_loadu_si128 (o),
+			                                    _mm_clmulepi64_si128 (x, y, 0)));
+		}
+	}
+}
+
+/*
+ * With a[i] broadcast to all lanes, the even and odd products of b words
+ * form 8 consecutive result words each, at offsets i and i+1.
+ */
+CCR_TARGET ("avx512f,vpclmulqdq")
+static void mul8_vpclmul (const uint64_t*a, const uint64_t*b, uint64_t*r)
+{
+	int i;
+	uint64_t t[2 * GF2X_BASE + 1];
+	for (i = 0; i < 2 * GF2X_BASE + 1; ++i) t[i] = 0;
+
+	__m512i y = _mm512_loadu_si512 (b);
+	for (i = 0; i < GF2X_BASE; ++i) {
+		__m512i x = _mm512_set1_epi64 (a[i]);
+		_mm512_storeu_si512 (t + i, _mm512_xor_si512 (
+		                         _mm512_loadu_si512 (t + i),
+		                         _mm512_clmulepi64_epi128 (x, y, 0x00)));
+		_mm512_storeu_si512 (t + i + 1, _mm512_xor_si512 (
+		                         _mm512_loadu_si512 (t + i + 1),
+		                         _mm512_clmulepi64_epi128 (x, y, 0x10)));
+	}
+	for (i = 0; i < 2 * GF2X_BASE; ++i) r[i] = t[i];
+}
+
+#endif //CCR_X86_SIMD
+
+typedef void (*mul8_kernel) (const uint64_t*, const uint64_t*, uint64_t*);
+
+static mul8_kernel pick_mul8_kernel()
+{
+#if CCR_X86_SIMD
+	if (cpu_has_vpclmul()) return mul8_vpclmul;
+	if (cpu_has_pclmul()) return mul8_pclmul;
+#endif
+	return mul8_generic;
+}
+
+/*
+ * Karatsuba on word counts that are multiples of GF2X_BASE. The split point h
+ * is rounded up to the base, the upper halves are zero-padded to h words.
+ * `tmp' must have space for 16*n words.
+ */
+static void karatsuba (const uint64_t*a, const uint64_t*b, size_t n,
+                       uint64_t*r, uint64_t*tmp, mul8_kernel base)
+{
+	if (n <= GF2X_BASE) {
+		base (a, b, r);
+		return;
+	}
+
+	size_t h = (n / 2 + GF2X_BASE - 1) / GF2X_BASE * GF2X_BASE, i;
+	size_t u = n - h; //size of the upper halves
+	uint64_t*a1 = tmp, *b1 = tmp + h, *as = tmp + 2 * h, *bs = tmp + 3 * h,
+	          *z1 = tmp + 4 * h, *z2 = tmp + 6 * h, *next = tmp + 8 * h;
+
+	for (i = 0; i < u; ++i) {
+		a1[i] = a[h + i];
+		b1[i] = b[h + i];
+	}
+	for (; i < h; ++i) a1[i] = b1[i] = 0;
+	for (i = 0; i < h; ++i) {
+		as[i] = a[i] ^ a1[i];
+		bs[i] = b[i] ^ b1[i];
+	}
+
+	karatsuba (a, b, h, r, next, base); //z0 goes to r[0..2h)
+	karatsuba (a1, b1, h, z2, next, base);
+	karatsuba (as, bs, h, z1, next, base);
+
+	for (i = 0; i < 2 * h; ++i) z1[i] ^= r[i] ^ z2[i];
+	for (i = 2 * h; i < 2 * n; ++i) r[i] = z2[i - 2 * h];
+	for (i = 0; i < 2 * h; ++i) r[h + i] ^= z1[i];
+}
+
+void gf2x_mul (const uint64_t*a, const uint64_t*b, size_t words, uint64_t*r)
+{
+	static mul8_kernel base = pick_mul8_kernel();
+
+	size_t n = (words + GF2X_BASE - 1) / GF2X_BASE * GF2X_BASE, i;
+	std::vector<uint64_t> pa (n, 0), pb (n, 0), pr (2 * n), tmp (16 * n);
+	for (i = 0; i < words; ++i) {
+		pa[i] = a[i];
+		pb[i] = b[i];
+	}
+
+	karatsuba (pa.data(), pb.data(), n, pr.data(), tmp.data(), base);
+	for (i = 0; i < 2 * words; ++i) r[i] = pr[i];
+}
+
+void gf2x_mul_mod (const bvector&a, const bvector&b, bvector&r)
+{
+	size_t n = a.size(), words = (n + 63) >> 6, i;
+	std::vector<uint64_t> p (2 * words + 1, 0);
+
+	gf2x_mul (a.words(), b.words(), words, p.data());
+
+	//fold the upper part (bits n and up) back to the bottom
+	r.clear();
+	r.resize (n, 0);
+	uint64_t*o = r.words();
+	const uint64_t*hi = p.data() + (n >> 6);
+	uint sh = n & 63;
+	for (i = 0; i < words; ++i)
+		o[i] = p[i] ^ (sh ? (hi[i] >> sh) | (hi[i + 1] << (64 - sh))
+		               : hi[i]);
+	r.fix_padding();
+}
+
+/*
+ * r = a^(2^k) mod x^n-1. Squaring is linear and maps x^i to x^(2i), so this
+ * is just a permutation of the bits.
+ */
+static void sqr_k_mod (const bvector&a, size_t k, bvector&r)
+{
+	size_t n = a.size(), m = 1, i;
+	for (i = 0; i < k; ++i) m = (2 * m) % n;
+
+	r.clear();
+	r.resize (n, 0);
+	uint64_t*o = r.words();
+	const uint64_t*in = a.words();
+	for (i = 0; i < n; ++i) {
+		size_t pos = (i * m) % n;
+		o[pos >> 6] |= ( (in[i >> 6] >> (i & 63)) & 1) << (pos & 63);
+	}
+}
+
+/*
+ * Itoh-Tsujii: for prime n, the multiplicative order of any invertible a
+ * divides 2^(n-1)-1, so the inverse is a^(2^(n-1)-2) = (a^(2^(n-2)-1))^2.
+ * With b_k = a^(2^k-1), b_(j+k) = b_j^(2^k) * b_k, which gives an addition
+ * chain of O(log n) multiplications.
+ */
+bool gf2x_inv_mod (const bvector&a, bvector&r)
+{
+	size_t n = a.size();
+	if (n < 3) return false;
+
+	size_t e = n - 2, k = 1, top = 0;
+	while (e >> (top + 1)) ++top;
+
+	bvector b = a, t;
+	for (size_t bit = top; bit > 0; --bit) {
+		sqr_k_mod (b, k, t);
+		gf2x_mul_mod (t, b, b);
+		k *= 2;
+		if ( (e >> (bit - 1)) & 1) {
+			sqr_k_mod (b, 1, t);
+			gf2x_mul_mod (t, a, b);
+			++k;
+		}
+	}
+	sqr_k_mod (b, 1, r);
+
+	//check, this also catches the non-invertible a's
+	gf2x_mul_mod (a, r, t);
+	return t.one();
+}
@@ -0,0 +1,49 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ccr_gf2x_h_
+#define _ccr_gf2x_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bvector.h"
+
+/*
+ * Exact multiplication of polynomials over GF(2), packed in 64bit words the
+ * same way as bvector does it.
+ *
+ * Uses Karatsuba recursion over carry-less multiplication of small blocks,
+ * with VPCLMULQDQ, PCLMULQDQ or portable kernels picked at runtime.
+ */
+
+//r = a*b, a and b have `words' words, r gets 2*words words
+void gf2x_mul (const uint64_t*a, const uint64_t*b, size_t words, uint64_t*r);
+
+//r = a*b mod x^n-1, where n = a.size() = b.size()
+void gf2x_mul_mod (const bvector&a, const bvector&b, bvector&r);
+
+/*
+ * r = inverse of a mod x^n-1, n = a.size() must be prime. Returns false if
+ * a is not invertible.
+ */
+bool gf2x_inv_mod (const bvector&a, bvector&r);
+
+#endif
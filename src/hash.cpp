@@ -47,3 +47,9 @@ hash_proc::suite_t& hash_proc::suite()
 
 	return s;
 }
+
+void hash_func::hash_many (const byte*in, size_t len, size_t n, byte*out)
+{
+	for (size_t i = 0; i < n; ++i, in += len, out += size())
+		hash (in, len, out);
+}
@@ -33,8 +33,24 @@
 class hash_func
 {
 public:
-	virtual std::vector<byte> operator() (const std::vector<byte>&) = 0;
+	//hashes len bytes at in, writes size() bytes to out
+	virtual void hash (const byte*in, size_t len, byte*out) = 0;
 	virtual uint size() = 0; //in bytes
+
+	std::vector<byte> operator() (const std::vector<byte>&a) {
+		std::vector<byte> r;
+		r.resize (size());
+		hash (a.data(), a.size(), r.data());
+		return r;
+	}
+
+	/*
+	 * hashes n independent inputs of len bytes each, stored one after
+	 * another; n outputs of size() bytes get stored the same way. Hashes
+	 * that can process several inputs in vector lanes override this.
+	 */
+	virtual void hash_many (const byte*in, size_t len, size_t n, byte*out);
+	virtual ~hash_func() {}
 };
 
 class hash_proc
@@ -44,9 +60,17 @@ public:
 	virtual void init() = 0;
 
 	virtual void eat (const byte*begin, const byte*end) = 0;
-	virtual std::vector<byte> finish() = 0;
+	//writes size() bytes of the result to out
+	virtual void finish (byte*out) = 0;
 	virtual ~hash_proc() {}
 
+	std::vector<byte> finish() {
+		std::vector<byte> r;
+		r.resize (size());
+		finish (r.data());
+		return r;
+	}
+
 	void eat (const std::vector<byte>&a) {
 		return eat (a.data(), a.data() + a.size());
 	}
@@ -20,11 +20,16 @@
 
 #include "hashfile.h"
 
+#include <algorithm>
 #include <map>
 #include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "hash.h"
 #include "iohelpers.h"
+#include "threadpool.h"
 
 /*
  * helper -- size measurement is a kindof-hash as well
@@ -51,14 +56,11 @@ public:
 		s += aend - a;
 	}
 
-	std::vector<byte> finish() {
-		std::vector<byte> r;
-		r.resize (8, 0);
+	void finish (byte*out) {
 		for (int i = 0; i < 8; ++i) {
-			r[i] = s & 0xff;
+			out[i] = s & 0xff;
 			s >>= 8;
 		}
-		return r;
 	}
 
 	bool cryptographically_significant() {
@@ -67,24 +69,195 @@ public:
 };
 
 /*
- * list of hash functions available
+ * list of hash functions available, or just the named ones. Returns false
+ * if some of the names are not known.
  */
 
 typedef std::map<std::string, instanceof<hash_proc> > hashmap;
 
-void fill_hashmap (hashmap&t)
+static bool fill_hashmap (hashmap&t, const std::set<std::string>&only)
 {
-	//copy contents of the hash suite
-	for (hash_proc::suite_t::iterator
-	     i = hash_proc::suite().begin(),
-	     e = hash_proc::suite().end();
-	     i != e; ++i) {
-		t[i->first] = i->second->get();
-		t[i->first].collect();
+	hash_proc::suite_t&suite = hash_proc::suite();
+
+	if (only.empty()) {
+		//copy contents of the hash suite
+		for (hash_proc::suite_t::iterator
+		     i = suite.begin(), e = suite.end(); i != e; ++i) {
+			t[i->first] = i->second->get();
+			t[i->first].collect();
+		}
+
+		//add size64 check
+		t["SIZE64"] = new size64proc;
+		return true;
+	}
+
+	bool ok = true;
+	for (std::set<std::string>::const_iterator
+	     i = only.begin(), e = only.end(); i != e; ++i)
+		if (*i == "SIZE64") t[*i] = new size64proc;
+		else if (suite.count (*i)) {
+			t[*i] = suite[*i]->get();
+			t[*i].collect();
+		} else ok = false;
+
+	return ok;
+}
+
+/*
+ * The read buffer starts small, so that short inputs don't allocate much,
+ * and doubles with each full read until it reaches the maximum.
+ */
+
+#define hash_buffer_start 8192
+#define hash_buffer_default (1 << 20)
+
+static size_t hash_buffer_grow (size_t size, size_t max)
+{
+	if (size >= max / 2) return max;
+	return 2 * size;
+}
+
+/*
+ * feed the whole input to all hashes in the map
+ */
+
+static bool hash_stream_serial (std::istream&in, hashmap&hm, size_t max)
+{
+	std::vector<byte> buf;
+	size_t size = std::min ( (size_t) hash_buffer_start, max);
+
+	for (;;) {
+		if (buf.size() < size) buf.resize (size);
+		in.read ( (char*) & (buf[0]), size);
+		if (!in && !in.eof()) return false;
+
+		const byte*b = & (buf[0]), *be = b + in.gcount();
+		for (hashmap::iterator i = hm.begin(), e = hm.end(); i != e; ++i)
+			i->second->eat (b, be);
+
+		if (!in) return true;
+		size = hash_buffer_grow (size, max);
+	}
+}
+
+/*
+ * Parallel variant: the input is read into a ring of blocks, and each
+ * worker thread runs its share of the hashes over every block. A block is
+ * refilled only after all workers are done with it, so the whole run takes
+ * about as long as the slowest hash instead of the sum of all of them.
+ */
+
+#define hash_ring_blocks 4
+
+class hash_ring
+{
+	std::vector<std::vector<hash_proc*> > groups;
+	std::vector<std::vector<byte> > blocks;
+	std::vector<size_t> lens;
+	std::vector<uint64_t> consumed; //blocks finished by each worker
+	uint64_t produced; //blocks filled by the reader
+	bool end;
+	size_t max;
+
+	std::mutex lock;
+	std::condition_variable cv;
+
+	void worker (uint w);
+	bool slot_free (uint64_t seq);
+
+public:
+	hash_ring (hashmap&hm, uint workers, size_t max);
+	bool run (std::istream&in);
+};
+
+hash_ring::hash_ring (hashmap&hm, uint workers, size_t max_buffer) :
+	groups (workers),
+	blocks (hash_ring_blocks),
+	lens (hash_ring_blocks, 0),
+	consumed (workers, 0),
+	produced (0), end (false),
+	max (max_buffer)
+{
+	uint w = 0;
+	for (hashmap::iterator i = hm.begin(), e = hm.end(); i != e; ++i) {
+		groups[w].push_back (&*i->second);
+		w = (w + 1) % workers;
+	}
+}
+
+void hash_ring::worker (uint w)
+{
+	for (uint64_t seq = 0;; ++seq) {
+		{
+			std::unique_lock<std::mutex> l (lock);
+			cv.wait (l, [&] {return end || produced > seq;});
+			if (produced <= seq) return;
+		}
+
+		const byte*b = & (blocks[seq % hash_ring_blocks][0]);
+		size_t n = lens[seq % hash_ring_blocks];
+		for (size_t i = 0; i < groups[w].size(); ++i)
+			groups[w][i]->eat (b, b + n);
+
+		{
+			std::lock_guard<std::mutex> l (lock);
+			consumed[w] = seq + 1;
+		}
+		cv.notify_all();
 	}
+}
 
-	//add size64 check
-	t["SIZE64"] = new size64proc;
+bool hash_ring::slot_free (uint64_t seq)
+{
+	for (size_t i = 0; i < consumed.size(); ++i)
+		if (consumed[i] + hash_ring_blocks <= seq) return false;
+	return true;
+}
+
+bool hash_ring::run (std::istream&in)
+{
+	std::vector<std::thread> threads;
+	for (uint w = 0; w < groups.size(); ++w)
+		threads.push_back (std::thread (&hash_ring::worker, this, w));
+
+	bool ok = true;
+	size_t size = std::min ( (size_t) hash_buffer_start, max);
+	for (uint64_t seq = 0;; ++seq) {
+		{
+			std::unique_lock<std::mutex> l (lock);
+			cv.wait (l, [&] {return slot_free (seq);});
+		}
+
+		std::vector<byte>&b = blocks[seq % hash_ring_blocks];
+		if (b.size() < size) b.resize (size);
+		in.read ( (char*) & (b[0]), size);
+		lens[seq % hash_ring_blocks] = in.gcount();
+		if (!in && !in.eof()) ok = false;
+
+		{
+			std::lock_guard<std::mutex> l (lock);
+			if (ok && in.gcount()) produced = seq + 1;
+			if (!in) end = true;
+		}
+		cv.notify_all();
+		if (!in) break;
+		size = hash_buffer_grow (size, max);
+	}
+
+	for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+	return ok;
+}
+
+static bool hash_stream (std::istream&in, hashmap&hm, size_t max)
+{
+	if (!max) max = hash_buffer_default;
+
+	uint workers = default_threads();
+	if (!workers) workers = std::thread::hardware_concurrency();
+	if (workers > hm.size()) workers = hm.size();
+	if (workers > 1) return hash_ring (hm, workers, max).run (in);
+	return hash_stream_serial (in, hm, max);
 }
 
 bool hashfile::create (std::istream&in)
@@ -92,43 +265,31 @@ bool hashfile::create (std::istream&in)
 	hashes.clear();
 
 	hashmap hm;
-	fill_hashmap (hm);
+	if (!fill_hashmap (hm, selection)) {
+		err ("error: unknown hash function selected");
+		return false;
+	}
 
 	for (hashmap::iterator i = hm.begin(), e = hm.end(); i != e; ++i)
 		i->second->init();
 
-	std::vector<byte> buf;
-	buf.resize (8192);
+	if (!hash_stream (in, hm, max_buffer)) return false;
 
-	for (;;) {
-		in.read ( (char*) & (buf[0]), 8192);
-		if (in)
-			for (hashmap::iterator i = hm.begin(), e = hm.end();
-			     i != e; ++i)
-				i->second->eat (buf);
-		else if (in.eof()) {
-			buf.resize (in.gcount());
-			for (hashmap::iterator i = hm.begin(), e = hm.end();
-			     i != e; ++i) {
-				i->second->eat (buf);
-				hashes[i->first] = i->second->finish();
-			}
-			return true;
-		} else return false;
-	}
+	for (hashmap::iterator i = hm.begin(), e = hm.end(); i != e; ++i)
+		hashes[i->first] = i->second->finish();
+
+	return true;
 }
 
 int hashfile::verify (std::istream&in)
 {
-	hashmap hm_all, hm;
-	fill_hashmap (hm_all);
-
+	//instantiate only the hashes that are going to be checked
+	std::set<std::string> names;
 	for (hashes_t::iterator i = hashes.begin(), e = hashes.end(); i != e; ++i)
-		if (hm_all.count (i->first)) {
-			hm[i->first] = hm_all[i->first];
-			hm_all[i->first].forget();
-		}
+		if (selected (i->first)) names.insert (i->first);
 
+	hashmap hm;
+	if (!names.empty()) fill_hashmap (hm, names);
 
 	if (hm.empty()) {
 		err ("notice: no verifiable hash found in hashfile");
@@ -138,28 +299,12 @@ int hashfile::verify (std::istream&in)
 	for (hashmap::iterator i = hm.begin(), e = hm.end(); i != e; ++i)
 		i->second->init();
 
-	std::vector<byte> buf;
-	buf.resize (8192);
-
-	for (;;) {
-		in.read ( (char*) & (buf[0]), 8192);
-		if (in)
-			for (hashmap::iterator i = hm.begin(), e = hm.end();
-			     i != e; ++i)
-				i->second->eat (buf);
-		else if (in.eof()) {
-			buf.resize (in.gcount());
-			for (hashmap::iterator i = hm.begin(), e = hm.end();
-			     i != e; ++i) {
-				i->second->eat (buf);
-			}
-			break;
-		} else return 1;
-	}
+	if (!hash_stream (in, hm, max_buffer)) return 1;
 
 	int ok = 0, failed = 0;
 	for (hashes_t::iterator i = hashes.begin(), e = hashes.end();
 	     i != e; ++i) {
+		if (!selected (i->first)) continue;
 		if (!hm.count (i->first)) {
 			err ("hash verification: :-/ "
 			     << escape_output (i->first) << " not supported");
@@ -28,6 +28,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 
 class hashfile
 {
@@ -35,6 +36,19 @@ public:
 	typedef std::map<std::string, std::vector<byte> > hashes_t;
 	hashes_t hashes;
 
+	/*
+	 * hashes to compute or check (all if empty), and the size limit of
+	 * the adaptively grown read buffer (0 for the default)
+	 */
+	std::set<std::string> selection;
+	size_t max_buffer;
+
+	hashfile() : max_buffer (0) {}
+
+	bool selected (const std::string&name) {
+		return selection.empty() || selection.count (name);
+	}
+
 	bool create (std::istream&);
 	int verify (std::istream&);
 
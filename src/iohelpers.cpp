@@ -20,18 +20,50 @@
 
 #include "iohelpers.h"
 
+#include <vector>
+
+#include <sys/stat.h>
+
+/*
+ * Redirected files get large stream buffers, so that reading and writing
+ * small chunks does not cost a syscall each.
+ */
+#define redirect_bufsize (1 << 20)
+
+static std::string cin_fn;
+
+//whether the output file is the input one, that would get truncated
+static bool same_as_input (const std::string& fn)
+{
+	struct stat in, out;
+	if (cin_fn.length() ? stat (cin_fn.c_str(), &in) : fstat (0, &in))
+		return false;
+	if (stat (fn.c_str(), &out)) return false;
+	return S_ISREG (in.st_mode) && in.st_dev == out.st_dev
+	       && in.st_ino == out.st_ino;
+}
+
 bool redirect_cin (const std::string& fn)
 {
+	//the buffer must outlive the stream, which flushes on exit
+	static std::vector<char> buf (redirect_bufsize);
 	static std::ifstream alt_cin;
+	alt_cin.rdbuf()->pubsetbuf (buf.data(), buf.size());
 	alt_cin.open (fn.c_str(), std::ios::in | std::ios::binary);
 	if (alt_cin.fail()) return false;
 	std::cin.rdbuf (alt_cin.rdbuf());
+	cin_fn = fn;
 	return true;
 }
 
 bool redirect_cout (const std::string& fn)
 {
+	if (same_as_input (fn)) return false;
+
+	//the buffer must outlive the stream, which flushes on exit
+	static std::vector<char> buf (redirect_bufsize);
 	static std::ofstream alt_cout;
+	alt_cout.rdbuf()->pubsetbuf (buf.data(), buf.size());
 	alt_cout.open (fn.c_str(), std::ios::out | std::ios::binary);
 	if (alt_cout.fail()) return false;
 	std::cout.rdbuf (alt_cout.rdbuf());
@@ -92,12 +92,31 @@ std::string keyring::get_keyid (const std::string&pubkey)
  *   ...
  * )
  *
+ * Stateful private keys (FMTseq) change on every signature. Instead of
+ * rewriting whole keyring, the new privkey of the single key is appended to
+ * ${CCR_DIR}/secrets.journal, each record being a sencode bytestring that
+ * contains
+ *
+ * ( "CCR-KEYPAIR-UPDATE" "key-id" privkey )
+ *
+ * Records are applied in order over the secrets when the keyring is opened;
+ * an incomplete record at the end (from a crash while writing) is ignored,
+ * together with the signature that could not have been output yet. Damage
+ * that breaks the record framing is taken for such a torn end, but a whole
+ * record that can't be decoded and is followed by more data makes opening
+ * the keyring fail, as the later records can't be trusted nor dropped.
+ *
+ * Every new privkey state is journaled before anything else is written, so
+ * replaying the journal gives each key its last state at any point of a full
+ * save, which writes the secrets and then empties the journal.
+ *
  * --------
  * Serialization stuff first.
  */
 
 #define KEYPAIRS_ID "CCR-KEYPAIRS"
 #define PUBKEYS_ID "CCR-PUBKEYS"
+#define KEYPAIR_UPDATE_ID "CCR-KEYPAIR-UPDATE"
 
 void keyring::clear_keypairs (keypair_storage&pairs)
 {
@@ -260,17 +279,23 @@ sencode* keyring::serialize_pubkeys (const pubkey_storage&pubs)
 
 #ifdef WIN32
 #define SECRETS_FILENAME "\\secrets"
+#define JOURNAL_FILENAME "\\secrets.journal"
 #define PUBKEYS_FILENAME "\\pubkeys"
 #define LOCK_FILENAME "\\lock"
 #define CCR_CONFDIR "\\.ccr"
 #else
 #define SECRETS_FILENAME "/secrets"
+#define JOURNAL_FILENAME "/secrets.journal"
 #define PUBKEYS_FILENAME "/pubkeys"
 #define LOCK_FILENAME "/lock"
 #define CCR_CONFDIR "/.ccr"
 #endif
 
 #define BAK_SUFFIX "~"
+#define NEW_SUFFIX ".new"
+
+//journal gets compacted when it's this many times bigger than secrets
+#define JOURNAL_COMPACT_RATIO 8
 
 #include <stdlib.h>
 
@@ -364,6 +389,24 @@ static sencode* file_get_sencode (const std::string&fn,
 	return sencode_decode (data);
 }
 
+static bool file_get_journal (const std::string&fn, std::string&data)
+{
+	//missing journal is empty
+	struct stat st;
+	data.clear();
+	if (stat (fn.c_str(), &st))
+		return errno == ENOENT;
+
+	if (!S_ISREG (st.st_mode))
+		return false;
+
+	data.resize (st.st_size, 0);
+	std::ifstream in (fn.c_str(), std::ios::in | std::ios::binary);
+	if (!in) return false;
+	in.read (&data[0], st.st_size);
+	return in.gcount() == st.st_size;
+}
+
 static bool file_put_string (const std::string&fn, const std::string&data)
 {
 	std::ofstream out (fn.c_str(), std::ios::out | std::ios::binary);
@@ -376,15 +419,183 @@ static bool file_put_string (const std::string&fn, const std::string&data)
 	return true;
 }
 
+static bool write_all (int fd, const std::string&data)
+{
+	size_t done = 0;
+	while (done < data.length()) {
+		ssize_t r = write (fd, data.data() + done,
+		                   data.length() - done);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		done += r;
+	}
+	return true;
+}
+
+/*
+ * Replaces the file so that after a crash it has either the old or the new
+ * contents, and the new ones are on the disk when this returns: the data go
+ * to a temporary file that is synced and renamed over the original, then
+ * the directory is synced.
+ */
+static bool file_put_string_sync (const std::string&dir,
+                                  const std::string&fn,
+                                  const std::string&data)
+{
+#ifdef WIN32
+	//no atomic replacement on windows yet
+	return file_put_string (fn, data);
+#else
+	struct stat st;
+	mode_t mode = S_IRUSR | S_IWUSR;
+	if (!stat (fn.c_str(), &st)) mode = st.st_mode & 0777;
+
+	std::string tmp = fn + NEW_SUFFIX;
+	int fd = ::open (tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0) return false;
+
+	if (fchmod (fd, mode) || !write_all (fd, data) || fsync (fd)) {
+		::close (fd);
+		unlink (tmp.c_str());
+		return false;
+	}
+	if (::close (fd) || rename (tmp.c_str(), fn.c_str())) {
+		unlink (tmp.c_str());
+		return false;
+	}
+
+	fd = ::open (dir.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool res = !fsync (fd);
+	return !::close (fd) && res;
+#endif
+}
+
 static bool file_put_sencode_with_backup (const std::string&fn, sencode*in,
                                           const std::string&backup_fn,
-                                          const std::string&backup_data)
+                                          const std::string&backup_data,
+                                          const std::string&sync_dir = "")
 {
 	std::string data = in->encode();
 	if (data == backup_data) return true; //nothing to do
 
-	return file_put_string (backup_fn, backup_data) &&
-	       file_put_string (fn, data);
+	if (!file_put_string (backup_fn, backup_data)) return false;
+	if (sync_dir.length())
+		return file_put_string_sync (sync_dir, fn, data);
+	return file_put_string (fn, data);
+}
+
+static bool file_append_string_sync (const std::string&fn,
+                                     const std::string&data)
+{
+	int fd = ::open (fn.c_str(), O_WRONLY | O_APPEND | O_CREAT,
+	                 S_IRUSR | S_IWUSR);
+	if (fd < 0) return false;
+
+	if (!write_all (fd, data)) {
+		::close (fd);
+		return false;
+	}
+
+#ifndef WIN32
+	//the record must hit the disk before the signature is output
+	if (fsync (fd)) {
+		::close (fd);
+		return false;
+	}
+#endif
+	return !::close (fd);
+}
+
+static std::string journal_record (const std::string&keyid,
+                                   const std::string&privkey_raw)
+{
+	sencode_list l;
+	sencode_bytes id (KEYPAIR_UPDATE_ID), kid (keyid), pk (privkey_raw);
+	l.items.push_back (&id);
+	l.items.push_back (&kid);
+	l.items.push_back (&pk);
+	sencode_bytes rec (l.encode());
+	l.items.clear(); //don't destroy the stack items
+	return rec.encode();
+}
+
+/*
+ * journal that replaces a broken one, with records of all the keypairs
+ */
+static bool journal_snapshot (keyring::keypair_storage&pairs, prng&rng,
+                              std::string&data)
+{
+	data.clear();
+	for (keyring::keypair_storage::iterator
+	     i = pairs.begin(), e = pairs.end(); i != e; ++i) {
+		if (!i->second.fix_dirty (rng)) return false;
+		data += journal_record (i->first, i->second.privkey_raw);
+	}
+	return true;
+}
+
+/*
+ * applies journal records to the keypairs. ok is set to false if the journal
+ * didn't end cleanly with a complete record; returns false if it's damaged
+ * before the end.
+ */
+static bool apply_journal (const std::string&data,
+                           keyring::keypair_storage&pairs, bool&ok)
+{
+	size_t pos = 0, len, digits;
+
+	ok = false;
+
+	while (pos < data.length()) {
+		//record length
+		len = 0;
+		digits = 0;
+		while (pos < data.length() && data[pos] >= '0'
+		       && data[pos] <= '9' && digits < 10) {
+			len = 10 * len + data[pos] - '0';
+			++pos;
+			++digits;
+		}
+		if (!digits || pos >= data.length() || data[pos] != ':')
+			return true;
+		++pos;
+		if (len > data.length() - pos) return true; //torn
+
+		sencode*S = sencode_decode (data.substr (pos, len));
+		pos += len;
+		if (!S) return pos == data.length();
+
+		sencode_list*L = dynamic_cast<sencode_list*> (S);
+		sencode_bytes *ID = NULL, *keyid = NULL, *privkey = NULL;
+		if (L && L->items.size() == 3) {
+			ID = dynamic_cast<sencode_bytes*> (L->items[0]);
+			keyid = dynamic_cast<sencode_bytes*> (L->items[1]);
+			privkey = dynamic_cast<sencode_bytes*> (L->items[2]);
+		}
+
+		if (! (ID && keyid && privkey && ID->b == KEYPAIR_UPDATE_ID)) {
+			sencode_destroy (S);
+			return pos == data.length();
+		}
+
+		//records of keys that were removed later are skipped
+		if (pairs.count (keyid->b)) {
+			keyring::keypair_entry&k = pairs[keyid->b];
+			if (k.privkey) {
+				sencode_destroy (k.privkey);
+				k.privkey = NULL;
+			}
+			k.privkey_raw = privkey->b;
+			k.dirty = false;
+		}
+		sencode_destroy (S);
+	}
+
+	ok = true;
+	return true;
 }
 
 #ifndef WIN32
@@ -449,10 +660,21 @@ bool keyring::save (prng&rng)
 
 	fn = dir + SECRETS_FILENAME;
 	bfn = fn + BAK_SUFFIX;
-	res = file_put_sencode_with_backup (fn, S, bfn, backup_pairs);
+	res = file_put_sencode_with_backup (fn, S, bfn, backup_pairs, dir);
 	sencode_destroy (S);
 	if (!res) goto failure;
 
+	/*
+	 * secrets now durably contain the last state of every key, which is
+	 * also what the journal replays to, so it may be emptied.
+	 */
+	if (journal_size || !journal_ok) {
+		if (!file_put_string_sync (dir, dir + JOURNAL_FILENAME, ""))
+			goto failure;
+		journal_size = 0;
+		journal_ok = true;
+	}
+
 	ignore_term_signals (false);
 	return true;
 
@@ -461,6 +683,43 @@ failure:
 	return false;
 }
 
+bool keyring::save_keypair (const std::string&keyid, prng&rng)
+{
+	keypair_entry*k = get_keypair (keyid);
+	if (!k) return false;
+
+	if (!k->fix_dirty (rng)) return false;
+	std::string dir = get_user_dir(),
+	            rec = journal_record (keyid, k->privkey_raw);
+
+	/*
+	 * the new state must be durably journaled before anything else. Broken
+	 * journal (also after a partially written record) can't be appended
+	 * to, it is atomically replaced by records of all keypairs instead.
+	 */
+	ignore_term_signals (true);
+	bool res = journal_ok
+	           && file_append_string_sync (dir + JOURNAL_FILENAME, rec);
+	if (res) journal_size += rec.length();
+	else {
+		journal_ok = false;
+		res = journal_snapshot (pairs, rng, rec)
+		      && file_put_string_sync (dir, dir + JOURNAL_FILENAME, rec);
+		if (res) {
+			journal_size = rec.length();
+			journal_ok = true;
+		}
+	}
+	ignore_term_signals (false);
+	if (!res) return false;
+
+	//compact the journal from time to time
+	if (journal_size > JOURNAL_COMPACT_RATIO * (backup_pairs.length() + 1))
+		return save (rng);
+
+	return true;
+}
+
 bool keyring::open()
 {
 	//ensure the existence of file structure
@@ -486,6 +745,7 @@ bool keyring::open()
 	fn = dir + PUBKEYS_FILENAME;
 
 	sencode *pubkeys, *keypairs;
+	std::string journal;
 	bool res;
 
 	pubkeys = file_get_sencode (fn, backup_pubs);
@@ -505,6 +765,12 @@ bool keyring::open()
 	sencode_destroy (keypairs);
 	if (!res) goto close_and_fail;
 
+	//apply the journal over them
+	fn = dir + JOURNAL_FILENAME;
+	if (!file_get_journal (fn, journal)) goto close_and_fail;
+	journal_size = journal.length();
+	if (!apply_journal (journal, pairs, journal_ok)) goto close_and_fail;
+
 	//all okay
 	return true;
 
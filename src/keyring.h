@@ -100,8 +100,14 @@ public:
 
 	std::string backup_pubs, backup_pairs;
 
+	//secrets journal state, see keyring.cpp
+	size_t journal_size;
+	bool journal_ok;
+
 	keyring() {
 		lockfd = -1;
+		journal_size = 0;
+		journal_ok = true;
 	}
 
 	~keyring() {
@@ -113,6 +119,8 @@ public:
 	bool open();
 	bool close();
 	bool save (prng&rng);
+	//stores only one changed keypair, using the journal
+	bool save_keypair (const std::string&keyid, prng&rng);
 
 	static std::string get_keyid (const std::string& pubkey);
 
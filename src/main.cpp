@@ -47,6 +47,7 @@ void print_help (char*pname)
 	out (" -E, --err     the same for stderr");
 	out (" -a, --armor   use ascii-armored I/O");
 	out (" -y, --yes     assume that answer is `yes' everytime");
+	out (" -j, --threads use N threads where possible, 0 for all cores");
 	outeol;
 	out ("Actions:");
 	out (" -s, --sign     sign a message");
@@ -62,6 +63,9 @@ void print_help (char*pname)
 	out (" -S, --symmetric    enable symmetric mode of operation where encryption");
 	out ("                    is done using symmetric cipher and signatures are");
 	out ("                    hashes, and specify a filename of symmetric key or hashes");
+	out (" -B, --range        symmetrically decrypt only bytes FROM-TO (TO excluded)");
+	out (" -H, --hashes       comma-separated hashes to put in (or check from) hashfile");
+	out (" -z, --hash-buffer  maximum read buffer size for hashing, e.g. 4M");
 	outeol;
 	out ("Key management:");
 	out (" -g, --gen-key        generate keys for specified algorithm");
@@ -118,6 +122,7 @@ void test()
 
 #include "actions.h"
 #include "algo_suite.h"
+#include "threadpool.h"
 
 int main (int argc, char**argv)
 {
@@ -138,7 +143,10 @@ int main (int argc, char**argv)
 	    withlock,
 	    action_param,
 	    detach_sign,
-	    symmetric;
+	    range,
+	    hashes, hash_buffer,
+	    symmetric,
+	    threads;
 
 	char action = 0;
 
@@ -152,6 +160,7 @@ int main (int argc, char**argv)
 			//global options
 			{"armor",	0,	0,	'a' },
 			{"yes",		0,	0,	'y' },
+			{"threads",	1,	0,	'j' },
 			{"recipient",	1,	0,	'r' },
 			{"user",	1,	0,	'u' },
 
@@ -196,6 +205,9 @@ int main (int argc, char**argv)
 			{"clearsign",	0,	0,	'C' },
 			{"detach-sign",	1,	0,	'b' },
 			{"symmetric",	1,	0,	'S' },
+			{"range",	1,	0,	'B' },
+			{"hashes",	1,	0,	'H' },
+			{"hash-buffer",	1,	0,	'z' },
 
 			{0,		0,	0,	0 }
 		};
@@ -203,7 +215,7 @@ int main (int argc, char**argv)
 		option_index = -1;
 		c = getopt_long
 		    (argc, argv,
-		     "hVTayr:u:R:o:E:kipx:m:KIPX:M:LUg:N:F:fnw:svedCb:S:",
+		     "hVTayj:r:u:R:o:E:kipx:m:KIPX:M:LUg:N:F:fnw:svedCb:S:B:H:z:",
 		     long_opts, &option_index);
 		if (c == -1) break;
 
@@ -243,6 +255,8 @@ int main (int argc, char**argv)
 			read_flag ('a', opt_armor)
 			read_flag ('y', opt_yes)
 
+			read_single_opt ('j', threads,
+			                 "specify only one thread count")
 			read_single_opt ('r', recipient,
 			                 "specify only one recipient")
 			read_single_opt ('u', user,
@@ -297,6 +311,12 @@ int main (int argc, char**argv)
 			                 "specify only one detach-sign file")
 			read_single_opt ('S', symmetric,
 			                 "specify only one symmetric parameter")
+			read_single_opt ('B', range,
+			                 "specify only one byte range")
+			read_single_opt ('H', hashes,
+			                 "specify only one hash list")
+			read_single_opt ('z', hash_buffer,
+			                 "specify only one hash buffer size")
 
 #undef read_flag
 #undef read_single_opt
@@ -339,6 +359,17 @@ int main (int argc, char**argv)
 		if (u) user = u;
 	}
 
+	//parallelism
+	if (threads.length()) {
+		char*end;
+		long t = strtol (threads.c_str(), &end, 10);
+		if (*end || t < 0) {
+			progerr ("invalid thread count");
+			return 1;
+		}
+		set_default_threads (t);
+	}
+
 	/*
 	 * cin/cout redirection
 	 */
@@ -417,17 +448,19 @@ int main (int argc, char**argv)
 
 	case 'd':
 		exitval = action_decrypt (opt_armor, symmetric, withlock,
-		                          KR, AS);
+		                          range, KR, AS);
 		break;
 
 	case 's':
 		exitval = action_sign (user, opt_armor, detach_sign,
-		                       opt_clearsign, symmetric, withlock, KR, AS);
+		                       opt_clearsign, symmetric,
+		                       hashes, hash_buffer, withlock, KR, AS);
 		break;
 
 	case 'v':
 		exitval = action_verify (opt_armor, detach_sign, opt_clearsign,
-		                         opt_yes, symmetric, withlock, KR, AS);
+		                         opt_yes, symmetric,
+		                         hashes, hash_buffer, withlock, KR, AS);
 		break;
 
 	case 'E':
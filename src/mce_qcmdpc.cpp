@@ -20,10 +20,14 @@
 
 #include "mce_qcmdpc.h"
 
-#include <list>
+#include <algorithm>
+#include <functional>
 #include <cmath>
 
 #include "fft.h"
+#include "gf2x.h"
+#include "qc_kernels.h"
+#include "threadpool.h"
 
 using namespace mce_qcmdpc;
 
@@ -39,12 +43,12 @@ int mce_qcmdpc::generate (pubkey&pub, privkey&priv, prng&rng,
 	pub.G.resize (block_count - 1);
 
 	/*
-	 * Cyclic matrices are diagonalizable by FFT so this stuff gets pretty
-	 * fast. Otherwise they behave like simple polynomials over GF(2) mod
-	 * (1+x^n).
+	 * Cyclic matrices behave like simple polynomials over GF(2) mod
+	 * (1+x^n). H blocks are sparse, so the products are just sums of
+	 * rotations.
 	 */
 
-	std::vector<dcx> H_last_inv;
+	bvector H_last_inv;
 
 	for (;;) {
 		//retry generating the rightmost block until it is invertible
@@ -55,33 +59,24 @@ int mce_qcmdpc::generate (pubkey&pub, privkey&priv, prng&rng,
 			     Hb[pos] ? 1 : (Hb[pos] = 1, 0);
 			     pos = rng.random (block_size));
 
-		bvector xnm1, Hb_inv, tmp;
-		xnm1.resize (block_size + 1, 0);
-		xnm1[0] = 1;
-		xnm1[block_size] = 1; //poly (x^n-1) in gf(2)
-
-		/*
-		 * TODO This is quadratic, speed it up.
-		 *
-		 * No one actually cares about keygen speed yet, but this can
-		 * be done in O(n*log(n)) using Schönhage-Strassen algorithm.
-		 * If speed is required (e.g. for SPF in some ssl replacement,
-		 * *wink* *wink*), use libNTL's GF2X.
-		 *
-		 * NTL one uses simpler Karatsuba with ~O(n^1.58) which should
-		 * (according to wikipedia) be faster for sizes under 32k bits
-		 * because of constant factors involved.
-		 */
-		bvector rem = Hb.ext_gcd (xnm1, Hb_inv, tmp);
-		if (!rem.one()) continue; //not invertible, retry
-		if (Hb_inv.size() > block_size) continue; //totally weird.
-		Hb_inv.resize (block_size, 0); //pad polynomial with zeros
+		bvector Hb_inv;
+		if (!gf2x_inv_mod (Hb, Hb_inv)) {
+			//not invertible, or block size isn't prime
+			bvector xnm1, tmp;
+			xnm1.resize (block_size + 1, 0);
+			xnm1[0] = 1;
+			xnm1[block_size] = 1; //poly (x^n-1) in gf(2)
+
+			bvector rem = Hb.ext_gcd (xnm1, Hb_inv, tmp);
+			if (!rem.one()) continue; //not invertible, retry
+			if (Hb_inv.size() > block_size) continue; //totally weird.
+			Hb_inv.resize (block_size, 0); //pad polynomial with zeros
+		}
 
 		//if it is, save it to matrix
 		priv.H[block_count - 1] = Hb;
 
-		//precompute the fft of the inverted last block
-		fft (Hb_inv, H_last_inv);
+		H_last_inv = Hb_inv;
 
 		break; //success
 	}
@@ -90,26 +85,24 @@ int mce_qcmdpc::generate (pubkey&pub, privkey&priv, prng&rng,
 	for (i = 0; i < block_count - 1; ++i) {
 		bvector Hb;
 		Hb.resize (block_size, 0);
+		std::vector<uint> Hsp;
 
 		//generate the polynomial corresponding to the first row
-		for (j = 0; j < wi; ++j)
-			for (uint pos = rng.random (block_size);
+		for (j = 0; j < wi; ++j) {
+			uint pos;
+			for (pos = rng.random (block_size);
 			     Hb[pos] ? 1 : (Hb[pos] = 1, 0);
 			     pos = rng.random (block_size));
+			Hsp.push_back (pos);
+		}
 
 		//save it to H
 		priv.H[i] = Hb;
 
-		//compute inv(H[last])*H[i]
-		std::vector<dcx> H;
-		fft (Hb, H);
-		for (j = 0; j < block_size; ++j)
-			H[j] *= H_last_inv[j];
-		fft (H, Hb);
-
-		//save it to G
-		pub.G[i] = Hb;
+		//compute inv(H[last])*H[i] and save it to G
+		pub.G[i].clear();
 		pub.G[i].resize (block_size, 0);
+		pub.G[i].rot_add_sparse (H_last_inv, Hsp);
 	}
 
 	//save the target params
@@ -120,8 +113,48 @@ int mce_qcmdpc::generate (pubkey&pub, privkey&priv, prng&rng,
 	return 0;
 }
 
+typedef std::vector<std::vector<uint> > sparse_blocks;
+
+static void sparse_index (const matrix&H, sparse_blocks&Hsp,
+                          sparse_blocks&Hsp_inv)
+{
+	uint bs = H[0].size();
+	Hsp.clear();
+	Hsp.resize (H.size());
+	Hsp_inv.clear();
+	Hsp_inv.resize (H.size());
+	for (uint i = 0; i < H.size(); ++i)
+		for (uint j = 0; j < bs; ++j)
+			if (H[i][j]) {
+				Hsp[i].push_back (j);
+				Hsp_inv[i].push_back (bs - j);
+			}
+}
+
 int privkey::prepare()
 {
+	if (H.empty()) return 1;
+	for (uint i = 1; i < H.size(); ++i)
+		if (H[i].size() != H[0].size()) return 2;
+
+	sparse_index (H, Hsp, Hsp_inv);
+	return 0;
+}
+
+int pubkey::prepare()
+{
+	if (G.empty()) return 1;
+	uint bs = G[0].size();
+	for (uint i = 1; i < G.size(); ++i)
+		if (G[i].size() != bs) return 1;
+
+	//only the FFT path benefits from a precomputed G
+	Gd.clear();
+	if (!use_fft) return 0;
+
+	fft_workspace ws;
+	Gd.resize (G.size());
+	for (uint i = 0; i < G.size(); ++i) fft (G[i], Gd[i], ws);
 	return 0;
 }
 
@@ -152,38 +185,69 @@ int pubkey::encrypt (const bvector&in, bvector&out, const bvector&errors)
 	for (uint i = 1; i < blocks; ++i)
 		if (G[i].size() != bs) return 1; //prevent mangled keys
 
-	//first, the checksum part
-	std::vector<dcx> bcheck, Pd, Gd;
-	bcheck.resize (bs, dcx (0, 0)); //initially zero
-	bvector block;
-
 	/*
 	 * G stores first row(s) of the circulant matrix blocks.  Proceed block
 	 * by block and construct the checksum.
-	 *
-	 * On a side note, it would be cool to store the G already pre-FFT'd,
-	 * but the performance gain wouldn't be interesting enough to
-	 * compensate for 128 times larger public key (each bit would get
-	 * expanded to two doubles). Do it if you want to encrypt bulk data.
 	 */
 
+	bvector block;
+	if (!use_fft) {
+		bvector check, tmp;
+		check.resize (bs, 0);
+		for (size_t i = 0; i < blocks; ++i) {
+			in.get_block (i * bs, bs, block);
+			gf2x_mul_mod (block, G[i], tmp);
+			check.add (tmp);
+		}
+
+		out = in;
+		out.append (check);
+		out.add (errors);
+		return 0;
+	}
+
+	std::vector<dcx> bcheck, Pd, Gtmp;
+	bcheck.resize (bs / 2 + 1, dcx (0, 0)); //initially zero
+	fft_workspace ws;
+
+	/*
+	 * Pre-FFT'd G is 64 times larger than the public key (each bit gets
+	 * expanded to half of a complex number), so it is only kept in memory
+	 * by prepare() when encrypting bulk data.
+	 */
+
+	bool cached = Gd.size() == blocks;
 	for (size_t i = 0; i < blocks; ++i) {
 		in.get_block (i * bs, bs, block);
-		fft (block, Pd);
-		fft (G[i], Gd);
-		for (size_t j = 0; j < bs; ++j)
-			bcheck[j] += Pd[j] * Gd[j];
+		fft (block, Pd, ws);
+		if (!cached) fft (G[i], Gtmp, ws);
+		const std::vector<dcx>&g = cached ? Gd[i] : Gtmp;
+		for (size_t j = 0; j < bcheck.size(); ++j)
+			bcheck[j] += Pd[j] * g[j];
 	}
 
 	//compute the ciphertext
 	out = in;
-	fft (bcheck, block); //get the checksum part
+	fft (bcheck, bs, block, ws); //get the checksum part
 	out.append (block);
 	out.add (errors);
 
 	return 0;
 }
 
+static inline uint ct_select (bool c, uint a, uint b)
+{
+	uint m = - (uint) c;
+	return (a & m) | (b & ~m);
+}
+
+static void run_jobs (thread_pool*pool, size_t n,
+                      const std::function<void (size_t)>&job)
+{
+	if (pool) pool->run (n, job);
+	else for (size_t i = 0; i < n; ++i) job (i);
+}
+
 int privkey::decrypt (const bvector & in, bvector & out)
 {
 	bvector tmp_errors;
@@ -192,7 +256,7 @@ int privkey::decrypt (const bvector & in, bvector & out)
 
 int privkey::decrypt (const bvector & in_orig, bvector & out, bvector & errors)
 {
-	uint i, j;
+	uint i;
 	uint cs = cipher_size();
 
 	if (in_orig.size() != cs) return 1;
@@ -206,101 +270,170 @@ int privkey::decrypt (const bvector & in_orig, bvector & out, bvector & errors)
 	 * probabilistic decoding!
 	 */
 
-	std::vector<dcx> synd_diag, tmp, Htmp;
-	synd_diag.resize (bs, dcx (0, 0));
+	//sparse matrix indexes, unless prepare()d already
+	sparse_blocks tmp_Hsp, tmp_Hsp_inv;
+	bool prepared = Hsp.size() == blocks && Hsp_inv.size() == blocks;
+	if (!prepared) sparse_index (H, tmp_Hsp, tmp_Hsp_inv);
+	const sparse_blocks&hsp = prepared ? Hsp : tmp_Hsp,
+	                    &hsp_inv = prepared ? Hsp_inv : tmp_Hsp_inv;
 
-	//precompute the syndrome
+	uint max_weight = 0;
+	for (i = 0; i < blocks; ++i)
+		if (hsp[i].size() > max_weight) max_weight = hsp[i].size();
+
+	//compute the syndrome
+	bvector syndrome;
+	syndrome.resize (bs, 0);
 	for (i = 0; i < blocks; ++i) {
 		bvector b;
-		b.resize (bs, 0);
-		b.add_offset (in, bs * i, 0, bs);
-		fft (b, tmp);
-		fft (H[i], Htmp);
-		for (j = 0; j < bs; ++j) synd_diag[j] += Htmp[j] * tmp[j];
+		in.get_block (bs * i, bs, b);
+		syndrome.rot_add_sparse (b, hsp[i]);
 	}
 
-	bvector syndrome;
-	fft (synd_diag, syndrome);
+	/*
+	 * The decoding works on whole bit-sliced vectors: unsatisfied parity
+	 * counts of all positions in a block are sums of rotated syndromes,
+	 * kept as binary counters in `planes' separate bit planes. All flips
+	 * of the round are decided from the counts at the round start (same
+	 * as the bit-by-bit version), and the syndrome is then updated by
+	 * adding rotated flip vectors.
+	 */
 
-	//precompute sparse matrix indexes
-	std::vector<std::list<uint> > Hsp;
-	Hsp.resize (blocks);
-	for (i = 0; i < blocks; ++i)
-		for (j = 0; j < bs; ++j)
-			if (H[i][j])
-				Hsp[i].push_back (j);
+	uint planes = 1;
+	while (planes < 32 && (1u << planes) <= max_weight) ++planes;
+	if (planes > 16) return 2; //nonsense weight
+
+	size_t words = qc_words (bs);
+	std::vector<uint64_t> synd, dbl, counts, flips;
+	synd.resize (words, 0);
+	std::copy (syndrome.words(), syndrome.words() + (bs + 63) / 64,
+	           synd.begin());
+	counts.resize (blocks * planes * words);
+	flips.resize (blocks * words);
+
+	bvector fb;
+	fb.resize (bs, 0);
 
 	/*
-	 * count the correlations, abuse the sparsity of matrices.
-	 *
-	 * TODO updating the counts and so is the slowest part of the whole
-	 * thing. It's all probabilistic, maybe there could be some potential
-	 * to speed it up by discarding some (already missing) precision.
+	 * The adaptive decoder stops as soon as the syndrome is zero and
+	 * rotates by the H offsets directly. The default one always runs all
+	 * rounds and uses the constant-time rotations, so that its timing
+	 * depends neither on the error pattern nor on the key.
 	 *
-	 * FFT would be a cool candidate.
+	 * With a thread pool, counting and syndrome updates are split to jobs
+	 * that write disjoint parts of the data (by blocks, and for the
+	 * adaptive decoder also by word chunks), so the result is the same as
+	 * from the serial decoder.
 	 */
 
-	std::vector<unsigned> unsat, round_unsat;
-	unsat.resize (cs, 0);
+	size_t chunk = words, nchunks = 1;
+	if (pool && adaptive_decoding && pool->size() > 1) {
+		chunk = (words / (2 * pool->size()) + 7) / 8 * 8;
+		if (chunk < 8) chunk = 8;
+		nchunks = (words + chunk - 1) / chunk;
+	}
+
+	std::vector<std::vector<uint64_t> > dflips (blocks);
+	std::vector<uint64_t> rot, acc;
+	std::vector<std::vector<uint64_t> > scratch; //for rotations, per job
+	if (!adaptive_decoding) {
+		rot.resize (blocks * words);
+		acc.resize (blocks * words);
+		scratch.resize (blocks);
+	}
+
+	std::function<void (size_t)> count_job = [&] (size_t job) {
+		uint blk = job / nchunks;
+		size_t from = (job % nchunks) * chunk,
+		       to = std::min (from + chunk, words);
+		uint64_t*c = counts.data() + blk * planes * words;
 
-	for (uint blk = 0; blk < blocks; ++blk)
-		for (uint i : Hsp[blk]) {
-			for (j = 0; j < bs; ++j)
-				if (syndrome[j])
-					++unsat[blk * bs + (j + bs - i) % bs];
+		if (adaptive_decoding) {
+			qc_count (dbl, hsp[blk], c, planes, words, from, to);
+			return;
+		}
+
+		uint64_t*r = rot.data() + blk * words;
+		std::fill (c, c + planes * words, 0);
+		for (uint h : hsp[blk]) {
+			qc_rotate_ct (synd.data(), bs, h, r, words,
+			              scratch[blk]);
+			qc_count_add (r, c, planes, words);
+		}
+	};
+
+	std::function<void (size_t)> update_job = [&] (size_t job) {
+		if (adaptive_decoding) {
+			size_t from = job * chunk,
+			       to = std::min (from + chunk, words);
+			for (uint blk = 0; blk < blocks; ++blk)
+				qc_xor_rotations (dflips[blk], hsp_inv[blk],
+				                  synd.data(), from, to);
+			return;
 		}
 
-	uint round;
-	for (round = 0;; ++round) {
+		uint64_t*r = rot.data() + job * words;
+		uint64_t*a = acc.data() + job * words;
+		uint64_t*f = flips.data() + job * words;
+		std::fill (a, a + words, 0);
+		for (uint h : hsp_inv[job]) {
+			qc_rotate_ct (f, bs, h, r, words, scratch[job]);
+			for (size_t k = 0; k < words; ++k) a[k] ^= r[k];
+		}
+	};
+
+	for (uint round = 0;; ++round) {
+
+		if (adaptive_decoding) {
+			bool zero = true;
+			for (i = 0; i < words; ++i) if (synd[i]) zero = false;
+			if (zero) break; //success
+			if (round >= rounds) return 3; //decoding failure
+		} else if (round >= rounds) break;
+
+		if (adaptive_decoding) qc_double (synd.data(), bs, dbl);
+
+		run_jobs (pool, blocks * nchunks, count_job);
 
 		uint max_unsat = 0;
-		for (i = 0; i < cs; ++i)
-			if (unsat[i] > max_unsat) max_unsat = unsat[i];
-		if (!max_unsat) break; //success
-		if (round >= rounds) return 3; //decoding failure
-		//TODO do something about possible timing attacks
-
-		uint threshold = 0;
-		if (max_unsat > delta) threshold = max_unsat - delta;
-
-		round_unsat = unsat;
-
-		for (uint bit = 0; bit < cs; ++bit) {
-			if (round_unsat[bit] <= threshold) continue;
-
-			/*
-			 * heavy trickery starts here, we carefully
-			 * modify the state to avoid necessity of
-			 * recomputation as a whole.
-			 */
-
-			uint blk = bit / bs, blkpos = bit % bs;
-
-			//adjust the error counts that were
-			//caused by this column of H
-			for (uint hpos : Hsp[blk]) {
-				hpos += blkpos;
-				//decide whether there's 1 or 0
-				bool increase = !syndrome[hpos % bs];
-				for (uint b2 = 0; b2 < blocks; ++b2)
-					for (uint h2 : Hsp[b2]) {
-						unsigned&
-						ref = unsat
-						      [b2 * bs
-						          + (hpos + bs - h2) % bs];
-						if (increase) ++ref;
-						else --ref;
-					}
-
-				//and flip it
-				syndrome.flip (hpos % bs);
-			}
+		for (uint blk = 0; blk < blocks; ++blk) {
+			uint64_t*c = counts.data() + blk * planes * words;
+			for (i = 0; i < planes; ++i)
+				qc_mask_padding (c + i * words, bs, words);
+			uint m = qc_count_max (c, planes, words);
+			max_unsat = ct_select (m > max_unsat, m, max_unsat);
+		}
+
+		uint threshold = ct_select (max_unsat > delta,
+		                            max_unsat - delta, 0);
 
-			//fix the bit
-			in.flip (bit);
+		for (uint blk = 0; blk < blocks; ++blk) {
+			uint64_t*f = flips.data() + blk * words;
+			qc_count_above (counts.data() + blk * planes * words,
+			                planes, words, threshold, f);
+			if (adaptive_decoding) qc_double (f, bs, dflips[blk]);
+
+			//fix the bits
+			std::copy (f, f + (bs + 63) / 64, fb.words());
+			in.add_offset (fb, 0, blk * bs, bs);
+		}
+
+		//update the syndrome
+		if (adaptive_decoding) run_jobs (pool, nchunks, update_job);
+		else {
+			run_jobs (pool, blocks, update_job);
+			for (uint blk = 0; blk < blocks; ++blk)
+				for (i = 0; i < words; ++i)
+					synd[i] ^= acc[blk * words + i];
 		}
+		qc_mask_padding (synd.data(), bs, words);
 	}
 
+	if (!adaptive_decoding) {
+		uint64_t nonzero = 0;
+		for (i = 0; i < words; ++i) nonzero |= synd[i];
+		if (nonzero) return 3; //decoding failure
+	}
 
 	errors = in_orig;
 	errors.add (in); //get the difference
@@ -25,6 +25,7 @@
 #include <stdint.h>
 
 #include "bvector.h"
+#include "fft.h"
 #include "matrix.h"
 #include "prng.h"
 #include "sencode.h"
@@ -34,6 +35,8 @@
  * quasi-cyclic MDPC McEliece
  * Implemented accordingly to the paper by Misoczki, Tillich, Sendrier and Barreto.
  */
+class thread_pool;
+
 namespace mce_qcmdpc
 {
 class privkey
@@ -44,6 +47,24 @@ public:
 	uint rounds;
 	uint delta;
 
+	/*
+	 * by default, decoding runs all `rounds' in constant time. Adaptive
+	 * decoding finishes early and is faster, but its timing leaks
+	 * information about the error pattern.
+	 */
+	bool adaptive_decoding;
+
+	//optional thread pool for parallel decoding (not owned)
+	thread_pool*pool;
+
+	/*
+	 * sparse form of H, precomputed by prepare(). Prepared keys may be
+	 * used for decryption from several threads at once.
+	 */
+	std::vector<std::vector<uint> > Hsp, Hsp_inv;
+
+	privkey() : adaptive_decoding (false), pool (NULL) {}
+
 	int decrypt (const bvector&, bvector&);
 	int decrypt (const bvector&, bvector&, bvector&);
 	int prepare();
@@ -68,8 +89,20 @@ public:
 	matrix G; //elems = top lines of right-side G blocks
 	uint t; //error count
 
+	/*
+	 * Encryption multiplies by G exactly, using carry-less multiplication.
+	 * The older floating-point FFT path can be selected by use_fft; for
+	 * that, prepare() caches the FFT'd G blocks in Gd (refresh or clear
+	 * it after G changes).
+	 */
+	bool use_fft;
+	std::vector<std::vector<dcx> > Gd;
+
+	pubkey() : use_fft (false) {}
+
 	int encrypt (const bvector&, bvector&, prng&);
 	int encrypt (const bvector&, bvector&, const bvector&);
+	int prepare();
 
 	uint cipher_size() {
 		return G[0].size() * (G.size() + 1);
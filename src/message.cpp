@@ -45,6 +45,28 @@ int encrypted_msg::encrypt (const bvector&msg,
 	return alg->encrypt (msg, ciphertext, pk->key, rng);
 }
 
+int encrypted_msg::encrypt (const bvector&msg,
+                            const std::string& Alg_id,
+                            const std::string& Key_id,
+                            algorithm_suite&algs, prepared_key*pk, prng&rng)
+{
+	key_id = Key_id;
+	alg_id = Alg_id;
+
+	algorithm*alg = NULL;
+	if (algs.count (alg_id)) {
+		alg = algs[alg_id];
+		if (!alg->provides_encryption())
+			alg = NULL;
+	}
+
+	if (!alg) return 1;
+
+	if (!pk) return 2; //key not prepared
+
+	return alg->encrypt_prepared (msg, ciphertext, pk, rng);
+}
+
 int encrypted_msg::decrypt (bvector& msg, algorithm_suite&algs, keyring& kr)
 {
 	algorithm*alg = NULL;
@@ -95,7 +117,7 @@ int signed_msg::sign (const bvector&msg,
 
 	if (k->dirty) {
 		//we can't output a signature without storing privkey changes!
-		if (!kr.save (rng)) return 4;
+		if (!kr.save_keypair (key_id, rng)) return 4;
 	}
 
 	return 0;
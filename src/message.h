@@ -40,6 +40,12 @@ public:
 	             const std::string& key_id,
 	             algorithm_suite&, keyring&, prng&);
 
+	//bulk variant with key from algorithm::prepare_pubkey()
+	int encrypt (const bvector& msg,
+	             const std::string& alg_id,
+	             const std::string& key_id,
+	             algorithm_suite&, prepared_key*, prng&);
+
 	sencode* serialize();
 	bool unserialize (sencode*);
 };
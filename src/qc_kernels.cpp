@@ -0,0 +1,371 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qc_kernels.h"
+
+#include "simd.h"
+
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * everything is padded to 8 words (512 bits), so that the vector kernels
+ * never need to care about remainders. Doubled arrays have some more words
+ * at the end, because the shifted reads look one word ahead.
+ */
+
+#define QC_WORD_ALIGN 8
+
+size_t qc_words (size_t n)
+{
+	size_t w = (n + 63) >> 6;
+	return (w + QC_WORD_ALIGN - 1) / QC_WORD_ALIGN * QC_WORD_ALIGN;
+}
+
+void qc_double (const uint64_t*v, size_t n, std::vector<uint64_t>&out)
+{
+	size_t vw = (n + 63) >> 6, sh = n & 63, i;
+
+	out.assign (2 * qc_words (n) + QC_WORD_ALIGN, 0);
+	for (i = 0; i < vw; ++i) out[i] = v[i];
+
+	//second copy starts at bit n
+	uint64_t*o = out.data() + (n >> 6);
+	if (!sh) for (i = 0; i < vw; ++i) o[i] = v[i];
+	else for (i = 0; i < vw; ++i) {
+			o[i] |= v[i] << sh;
+			o[i + 1] |= v[i] >> (64 - sh);
+		}
+}
+
+void qc_mask_padding (uint64_t*v, size_t n, size_t words)
+{
+	size_t i = n >> 6;
+	if (i >= words) return;
+	if (n & 63) v[i++] &= ~ (0xFfffFfffFfffFfffull << (n & 63));
+	for (; i < words; ++i) v[i] = 0;
+}
+
+/*
+ * portable kernels
+ */
+
+static inline uint64_t shifted_word (const uint64_t*src, uint sh)
+{
+	if (!sh) return src[0];
+	return (src[0] >> sh) | (src[1] << (64 - sh));
+}
+
+template<int P>
+static void count_generic (const uint64_t*dbl, const uint*offs, size_t noffs,
+                           uint64_t*planes, uint nplanes, size_t words,
+                           size_t from, size_t to)
+{
+	for (size_t k = from; k < to; ++k) {
+		uint64_t acc[P];
+		int i;
+		for (i = 0; i < P; ++i) acc[i] = 0;
+
+		for (size_t j = 0; j < noffs; ++j) {
+			uint64_t c = shifted_word (dbl + (offs[j] >> 6) + k,
+			                           offs[j] & 63);
+			//ripple-carry addition of c to the counters
+			for (i = 0; i < P; ++i) {
+				uint64_t t = acc[i] & c;
+				acc[i] ^= c;
+				c = t;
+			}
+		}
+
+		for (uint p = 0; p < nplanes; ++p)
+			planes[p * words + k] = acc[p];
+	}
+}
+
+static void xor_rot_generic (const uint64_t*dbl, const uint*offs, size_t noffs,
+                             uint64_t*out, size_t from, size_t to)
+{
+	for (size_t k = from; k < to; ++k) {
+		uint64_t acc = 0;
+		for (size_t j = 0; j < noffs; ++j)
+			acc ^= shifted_word (dbl + (offs[j] >> 6) + k,
+			                     offs[j] & 63);
+		out[k] ^= acc;
+	}
+}
+
+#if CCR_X86_SIMD
+
+/*
+ * AVX2 and AVX-512 kernels are the same as the generic ones, only process 4
+ * or 8 words at once. Vector shifts by 64 bits produce zeroes, so there's no
+ * need to special-case the aligned offsets.
+ * (The masked AVX-512 shifts only avoid spurious gcc warnings.)
+ */
+
+//4 words of the vector rotated by offset o
+CCR_TARGET ("avx2")
+static inline __m256i shifted_avx2 (const uint64_t*dbl, uint o, size_t k)
+{
+	const uint64_t*s = dbl + (o >> 6) + k;
+	__m256i lo = _mm256_loadu_si256 ( (const __m256i*) s),
+	        hi = _mm256_loadu_si256 ( (const __m256i*) (s + 1));
+	return _mm256_or_si256 (
+	           _mm256_srl_epi64 (lo, _mm_cvtsi32_si128 (o & 63)),
+	           _mm256_sll_epi64 (hi, _mm_cvtsi32_si128 (64 - (o & 63))));
+}
+
+template<int P>
+CCR_TARGET ("avx2")
+static void count_avx2 (const uint64_t*dbl, const uint*offs, size_t noffs,
+                        uint64_t*planes, uint nplanes, size_t words,
+                        size_t from, size_t to)
+{
+	for (size_t k = from; k < to; k += 4) {
+		__m256i acc[P];
+		int i;
+		for (i = 0; i < P; ++i) acc[i] = _mm256_setzero_si256();
+
+		for (size_t j = 0; j < noffs; ++j) {
+			__m256i c = shifted_avx2 (dbl, offs[j], k);
+			for (i = 0; i < P; ++i) {
+				__m256i t = _mm256_and_si256 (acc[i], c);
+				acc[i] = _mm256_xor_si256 (acc[i], c);
+				c = t;
+			}
+		}
+
+		for (uint p = 0; p < nplanes; ++p)
+			_mm256_storeu_si256 ( (__m256i*) (planes + p * words + k),
+			                      acc[p]);
+	}
+}
+
+CCR_TARGET ("avx2")
+static void xor_rot_avx2 (const uint64_t*dbl, const uint*offs, size_t noffs,
+                          uint64_t*out, size_t from, size_t to)
+{
+	for (size_t k = from; k < to; k += 4) {
+		__m256i acc = _mm256_setzero_si256();
+		for (size_t j = 0; j < noffs; ++j)
+			acc = _mm256_xor_si256 (acc, shifted_avx2 (dbl, offs[j], k));
+		__m256i*o = (__m256i*) (out + k);
+		_mm256_storeu_si256 (o, _mm256_xor_si256 (_mm256_loadu_si256 (o),
+		                     acc));
+	}
+}
+
+//8 words of the vector rotated by offset o
+CCR_TARGET ("avx512f")
+static inline __m512i shifted_avx512 (const uint64_t*dbl, uint o, size_t k)
+{
+	const uint64_t*s = dbl + (o >> 6) + k;
+	__m512i lo = _mm512_loadu_si512 (s), hi = _mm512_loadu_si512 (s + 1);
+	return _mm512_or_si512 (
+	           _mm512_maskz_srl_epi64 (0xff, lo, _mm_cvtsi32_si128 (o & 63)),
+	           _mm512_maskz_sll_epi64 (0xff, hi,
+	                                   _mm_cvtsi32_si128 (64 - (o & 63))));
+}
+
+template<int P>
+CCR_TARGET ("avx512f")
+static void count_avx512 (const uint64_t*dbl, const uint*offs, size_t noffs,
+                          uint64_t*planes, uint nplanes, size_t words,
+                          size_t from, size_t to)
+{
+	for (size_t k = from; k < to; k += 8) {
+		__m512i acc[P];
+		int i;
+		for (i = 0; i < P; ++i) acc[i] = _mm512_setzero_si512();
+
+		for (size_t j = 0; j < noffs; ++j) {
+			__m512i c = shifted_avx512 (dbl, offs[j], k);
+			for (i = 0; i < P; ++i) {
+				__m512i t = _mm512_and_si512 (acc[i], c);
+				acc[i] = _mm512_xor_si512 (acc[i], c);
+				c = t;
+			}
+		}
+
+		for (uint p = 0; p < nplanes; ++p)
+			_mm512_storeu_si512 (planes + p * words + k, acc[p]);
+	}
+}
+
+CCR_TARGET ("avx512f")
+static void xor_rot_avx512 (const uint64_t*dbl, const uint*offs, size_t noffs,
+                            uint64_t*out, size_t from, size_t to)
+{
+	for (size_t k = from; k < to; k += 8) {
+		__m512i acc = _mm512_setzero_si512();
+		for (size_t j = 0; j < noffs; ++j)
+			acc = _mm512_xor_si512 (acc, shifted_avx512 (dbl, offs[j], k));
+		_mm512_storeu_si512 (out + k, _mm512_xor_si512 (
+		                         _mm512_loadu_si512 (out + k), acc));
+	}
+}
+
+#endif //CCR_X86_SIMD
+
+/*
+ * runtime dispatch
+ */
+
+typedef void (*count_kernel) (const uint64_t*, const uint*, size_t,
+                              uint64_t*, uint, size_t, size_t, size_t);
+typedef void (*xor_rot_kernel) (const uint64_t*, const uint*, size_t,
+                                uint64_t*, size_t, size_t);
+
+template<int P>
+static count_kernel pick_count_kernel()
+{
+#if CCR_X86_SIMD
+	if (cpu_has_avx512()) return count_avx512<P>;
+	if (cpu_has_avx2()) return count_avx2<P>;
+#endif
+	return count_generic<P>;
+}
+
+static xor_rot_kernel pick_xor_rot_kernel()
+{
+#if CCR_X86_SIMD
+	if (cpu_has_avx512()) return xor_rot_avx512;
+	if (cpu_has_avx2()) return xor_rot_avx2;
+#endif
+	return xor_rot_generic;
+}
+
+void qc_count (const std::vector<uint64_t>&dbl,
+               const std::vector<uint>&offsets,
+               uint64_t*planes, uint nplanes, size_t words,
+               size_t from, size_t to)
+{
+	//counters wider than needed are fine, only nplanes get stored
+	static count_kernel k8 = pick_count_kernel<8>(),
+	                    k16 = pick_count_kernel<16>();
+
+	if (nplanes <= 8) k8 (dbl.data(), offsets.data(), offsets.size(),
+		                      planes, nplanes, words, from, to);
+	else k16 (dbl.data(), offsets.data(), offsets.size(),
+		          planes, nplanes, words, from, to);
+}
+
+void qc_xor_rotations (const std::vector<uint64_t>&dbl,
+                       const std::vector<uint>&offsets,
+                       uint64_t*out, size_t from, size_t to)
+{
+	static xor_rot_kernel k = pick_xor_rot_kernel();
+	k (dbl.data(), offsets.data(), offsets.size(), out, from, to);
+}
+
+/*
+ * bit-sliced comparisons. These run once per decoding round, the portable
+ * versions are fast enough. Neither branches on the counter values, so that
+ * decoder timing doesn't depend on the error pattern.
+ */
+
+void qc_count_add (const uint64_t*v, uint64_t*planes, uint nplanes,
+                   size_t words)
+{
+	for (size_t k = 0; k < words; ++k) {
+		uint64_t c = v[k];
+		for (uint i = 0; i < nplanes; ++i) {
+			uint64_t&p = planes[i * words + k];
+			uint64_t t = p & c;
+			p ^= c;
+			c = t;
+		}
+	}
+}
+
+uint qc_count_max (const uint64_t*planes, uint nplanes, size_t words)
+{
+	uint r = 0;
+	size_t k;
+	std::vector<uint64_t> cand, t;
+	cand.resize (words, ~ (uint64_t) 0);
+	t.resize (words);
+
+	//go from the top bit, keep the candidates that can still be maximal
+	for (uint i = nplanes; i > 0; --i) {
+		const uint64_t*p = planes + (i - 1) * words;
+		uint64_t any = 0;
+		for (k = 0; k < words; ++k) {
+			t[k] = cand[k] & p[k];
+			any |= t[k];
+		}
+
+		//mask is all ones iff some candidate has this bit set
+		uint64_t m = - ( (any | -any) >> 63);
+		for (k = 0; k < words; ++k)
+			cand[k] = (t[k] & m) | (cand[k] & ~m);
+		r |= (m & 1) << (i - 1);
+	}
+
+	return r;
+}
+
+void qc_count_above (const uint64_t*planes, uint nplanes, size_t words,
+                     uint threshold, uint64_t*out)
+{
+	for (size_t k = 0; k < words; ++k) {
+		uint64_t gt = 0, eq = ~ (uint64_t) 0;
+		for (uint i = nplanes; i > 0; --i) {
+			uint64_t p = planes[ (i - 1) * words + k],
+			         tb = - (uint64_t) ( (threshold >> (i - 1)) & 1);
+			gt |= eq & p & ~tb;
+			eq &= ~ (p ^ tb);
+		}
+		//thresholds that don't fit in the counters are never reached
+		if (nplanes < 32) gt &= - (uint64_t) ! (threshold >> nplanes);
+		out[k] = gt;
+	}
+}
+
+void qc_rotate_ct (const uint64_t*v, size_t n, uint r,
+                   uint64_t*out, size_t words, std::vector<uint64_t>&dbl)
+{
+	/*
+	 * The rotation is a shift of the doubled vector by r. The whole-word
+	 * part is done by conditional shifts by powers of two words from the
+	 * largest one; after shifting by q words the remaining shift is smaller
+	 * than that, so only the words that can still reach the result need to
+	 * be computed. The rest (below 64 bits) is a variable shift, which
+	 * takes constant time on the usual CPUs.
+	 */
+	qc_double (v, n, dbl);
+	size_t top = 0, k;
+	while ( ( (size_t) 64 << top) < n) ++top;
+	dbl.resize (words + 2 * ( (n >> 6) + 2), 0);
+	uint64_t*d = dbl.data();
+
+	for (size_t bit = top; bit > 0; --bit) {
+		size_t q = (size_t) 1 << (bit - 1), len = words + q + 1;
+		uint64_t m = - (uint64_t) ( (r >> (bit + 5)) & 1);
+		for (k = 0; k < len; ++k)
+			d[k] = (d[k + q] & m) | (d[k] & ~m);
+	}
+
+	uint sh = r & 63;
+	for (k = 0; k < words; ++k)
+		out[k] = (d[k] >> sh) | ( (d[k + 1] << 1) << (63 - sh));
+	qc_mask_padding (out, n, words);
+}
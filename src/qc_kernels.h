@@ -0,0 +1,89 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ccr_qc_kernels_h_
+#define _ccr_qc_kernels_h_
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+/*
+ * Packed-word kernels for the quasi-cyclic arithmetic over GF(2).
+ *
+ * Vectors are arrays of 64bit words in the bvector layout (bit i sits in bit
+ * i%64 of word i/64) with zeroed padding. All rotations are done on "doubled"
+ * vectors, i.e. the n-bit vector stored twice in a row, from which a vector
+ * rotated by r can be read as a plain bit-shifted block starting at bit r.
+ *
+ * Bulk kernels are picked at runtime from AVX-512, AVX2 and portable variants.
+ */
+
+//word count of n-bit vector, padded for the widest vector unit
+size_t qc_words (size_t n);
+
+//prepare the doubled form of n-bit vector v
+void qc_double (const uint64_t*v, size_t n, std::vector<uint64_t>&out);
+
+//clear the bits of words-long vector that lie beyond the first n
+void qc_mask_padding (uint64_t*v, size_t n, size_t words);
+
+/*
+ * Bit-sliced counters: the counter for position p has its i-th bit in bit p
+ * of the i-th plane, planes are stored one after another, each `words' long.
+ *
+ * qc_count sets the counters to sum of dbl[p+o] for all offsets o. The bulk
+ * kernels only process words from `from' to `to' (multiples of 8), so that
+ * the work can be split between threads.
+ */
+void qc_count (const std::vector<uint64_t>&dbl,
+               const std::vector<uint>&offsets,
+               uint64_t*planes, uint nplanes, size_t words,
+               size_t from, size_t to);
+
+//add vector v to the counters
+void qc_count_add (const uint64_t*v, uint64_t*planes, uint nplanes,
+                   size_t words);
+
+//maximum of the counters (branch-free)
+uint qc_count_max (const uint64_t*planes, uint nplanes, size_t words);
+
+//set bits of out where the counter is strictly larger than threshold
+//(branch-free)
+void qc_count_above (const uint64_t*planes, uint nplanes, size_t words,
+                     uint threshold, uint64_t*out);
+
+//out[p] ^= sum of dbl[p+o] for all offsets o
+void qc_xor_rotations (const std::vector<uint64_t>&dbl,
+                       const std::vector<uint>&offsets,
+                       uint64_t*out, size_t from, size_t to);
+
+/*
+ * Rotation that doesn't leak the rotation amount through timing or memory
+ * access pattern: out[p] = v[(p+r) mod n], composed of conditionally applied
+ * shifts by powers of two. dbl is the caller's scratch space, so that it can
+ * be reused across calls.
+ */
+void qc_rotate_ct (const uint64_t*v, size_t n, uint r,
+                   uint64_t*out, size_t words, std::vector<uint64_t>&dbl);
+
+#endif
@@ -21,6 +21,14 @@
 #include "sc.h"
 
 #include "str_match.h"
+#include "simd.h"
+
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include <string.h>
+#include <stdint.h>
 
 #include "arcfour.h"
 #include "xsynd.h"
@@ -43,3 +51,37 @@ streamcipher::suite_t& streamcipher::suite()
 
 	return s;
 }
+
+#if CCR_X86_SIMD
+CCR_TARGET ("avx2")
+static size_t xor_bytes_avx2 (byte*dst, const byte*src, size_t n)
+{
+	size_t i;
+	for (i = 0; i + 32 <= n; i += 32)
+		_mm256_storeu_si256 ( (__m256i*) (dst + i),
+		                      _mm256_xor_si256 (
+		                          _mm256_loadu_si256 ( (__m256i*) (dst + i)),
+		                          _mm256_loadu_si256 ( (__m256i*) (src + i))));
+	return i;
+}
+#endif
+
+void xor_bytes (byte*dst, const byte*src, size_t n)
+{
+	size_t i = 0;
+
+#if CCR_X86_SIMD
+	static bool avx2 = cpu_has_avx2();
+	if (avx2) i = xor_bytes_avx2 (dst, src, n);
+#endif
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t a, b;
+		memcpy (&a, dst + i, 8);
+		memcpy (&b, src + i, 8);
+		a ^= b;
+		memcpy (dst + i, &a, 8);
+	}
+
+	for (; i < n; ++i) dst[i] ^= src[i];
+}
@@ -38,6 +38,8 @@ public:
 	virtual void load_key (const byte*begin, const byte*end) = 0;
 	virtual byte gen() = 0;
 	virtual void gen (size_t n, byte*out) = 0;
+	//data ^= next n bytes of the keystream
+	virtual void xor_into (byte*data, size_t n) = 0;
 
 	//advisory values for effective usage
 	virtual size_t key_size() = 0;
@@ -57,4 +59,7 @@ public:
 	static suite_t& suite();
 };
 
+//dst ^= src, for n bytes
+void xor_bytes (byte*dst, const byte*src, size_t n);
+
 #endif
@@ -31,6 +31,8 @@
 #include "hashfile.h"
 #include "symkey.h"
 
+#include <string.h>
+
 #define CAST(IN,OUT,TYPE) \
 	OUT=dynamic_cast<TYPE>(IN); \
 	if(!OUT) return false;
@@ -255,6 +257,90 @@ bool fmtseq::privkey::tree_stk_item::unserialize (sencode*s)
 
 }
 
+/*
+ * FMTseq subtree caches are stored either as lists of separate node hashes
+ * (the original format), or packed, each subtree as a single bytestring of
+ * all its node hashes concatenated in the cache order.
+ */
+
+typedef std::vector<std::vector<std::vector<byte> > > fmtseq_trees;
+
+static bool fmtseq_trees_packable (const fmtseq_trees&trees, uint h)
+{
+	size_t ts = ( (size_t) 1 << (h + 1)) - 2, hsz = 0;
+	for (size_t i = 0; i < trees.size(); ++i) {
+		if (trees[i].size() != ts) return false;
+		for (size_t j = 0; j < ts; ++j) {
+			if (!i && !j) hsz = trees[i][j].size();
+			if (trees[i][j].size() != hsz) return false;
+		}
+	}
+	return true;
+}
+
+static sencode* fmtseq_serialize_trees (const fmtseq_trees&trees, bool packed)
+{
+	sencode_list *L = new sencode_list;
+	L->items.resize (trees.size());
+	for (size_t i = 0; i < trees.size(); ++i) {
+		if (packed) {
+			sencode_bytes *b = new sencode_bytes ("");
+			L->items[i] = b;
+			if (trees[i].empty()) continue;
+			size_t hsz = trees[i][0].size();
+			b->b.resize (hsz * trees[i].size());
+			for (size_t j = 0; hsz && j < trees[i].size(); ++j)
+				memcpy (&b->b[j * hsz], trees[i][j].data(), hsz);
+		} else {
+			sencode_list *t = new sencode_list;
+			L->items[i] = t;
+			t->items.resize (trees[i].size());
+			for (size_t j = 0; j < trees[i].size(); ++j)
+				t->items[j] = new sencode_bytes (trees[i][j]);
+		}
+	}
+	return L;
+}
+
+static bool fmtseq_unserialize_trees (sencode*s, fmtseq_trees&trees,
+                                      uint h, bool packed)
+{
+	sencode_list*CAST_LIST (s, A);
+	trees.clear();
+	trees.resize (A->items.size());
+
+	if (packed) {
+		if (h >= 30) return false;
+		size_t ts = ( (size_t) 1 << (h + 1)) - 2;
+		for (size_t i = 0; i < trees.size(); ++i) {
+			sencode_bytes*CAST_BYTES (A->items[i], B);
+			if (!ts || B->b.length() % ts) return false;
+			size_t hsz = B->b.length() / ts;
+			const byte*src = (const byte*) B->b.data();
+			trees[i].resize (ts);
+			for (size_t j = 0; j < ts; ++j)
+				trees[i][j].assign (src + j * hsz,
+				                    src + (j + 1) * hsz);
+		}
+		return true;
+	}
+
+	for (size_t i = 0; i < trees.size(); ++i) {
+		sencode_list*CAST_LIST (A->items[i], t);
+		trees[i].resize (t->items.size());
+		for (size_t j = 0; j < trees[i].size(); ++j) {
+			sencode_bytes*CAST_BYTES (t->items[j], item);
+			trees[i][j] = std::vector<byte>
+			              (item->b.begin(),
+			               item->b.end());
+		}
+	}
+	return true;
+}
+
+#define FMTSEQ_PRIVKEY_IDENT PRIVKEY_IDENT "FMTSEQ"
+#define FMTSEQ_PACKED_PRIVKEY_IDENT PRIVKEY_IDENT "FMTSEQ-v2"
+
 sencode* fmtseq::privkey::serialize()
 {
 	/*
@@ -271,43 +357,32 @@ sencode* fmtseq::privkey::serialize()
 	 *     ...)
 	 *   ( progress1 progress2 ...)
 	 * )
+	 *
+	 * "-v2" version has the same structure, only the exist and desired
+	 * lists contain one packed bytestring for each subtree.
 	 */
 
 	uint i, j;
+	bool packed = fmtseq_trees_packable (exist, h)
+	              && fmtseq_trees_packable (desired, h);
 
 	sencode_list*L = new sencode_list;
 	L->items.resize (10);
-	L->items[0] = new sencode_bytes (PRIVKEY_IDENT "FMTSEQ");
+	L->items[0] = new sencode_bytes (packed ?
+	                                 FMTSEQ_PACKED_PRIVKEY_IDENT :
+	                                 FMTSEQ_PRIVKEY_IDENT);
 	L->items[1] = new sencode_bytes (SK);
 	L->items[2] = new sencode_int (h);
 	L->items[3] = new sencode_int (l);
 	L->items[4] = new sencode_int (hs);
 	L->items[5] = new sencode_int (sigs_used);
 
-	sencode_list *E, *D, *S, *P;
-	L->items[6] = E = new sencode_list;
-	L->items[7] = D = new sencode_list;
+	sencode_list *S, *P;
+	L->items[6] = fmtseq_serialize_trees (exist, packed);
+	L->items[7] = fmtseq_serialize_trees (desired, packed);
 	L->items[8] = S = new sencode_list;
 	L->items[9] = P = new sencode_list;
 
-	E->items.resize (exist.size());
-	for (i = 0; i < exist.size(); ++i) {
-		sencode_list *t = new sencode_list;
-		E->items[i] = t;
-		t->items.resize (exist[i].size());
-		for (j = 0; j < exist[i].size(); ++j)
-			t->items[j] = new sencode_bytes (exist[i][j]);
-	}
-
-	D->items.resize (desired.size());
-	for (i = 0; i < desired.size(); ++i) {
-		sencode_list *t = new sencode_list;
-		D->items[i] = t;
-		t->items.resize (desired[i].size());
-		for (j = 0; j < desired[i].size(); ++j)
-			t->items[j] = new sencode_bytes (desired[i][j]);
-	}
-
 	S->items.resize (desired_stack.size());
 	for (i = 0; i < desired_stack.size(); ++i) {
 		sencode_list *t = new sencode_list;
@@ -331,7 +406,10 @@ bool fmtseq::privkey::unserialize (sencode*s)
 	if (L->items.size() != 10) return false;
 
 	sencode_bytes*CAST_BYTES (L->items[0], ident);
-	if (ident->b.compare (PRIVKEY_IDENT "FMTSEQ")) return false;
+	bool packed;
+	if (!ident->b.compare (FMTSEQ_PACKED_PRIVKEY_IDENT)) packed = true;
+	else if (!ident->b.compare (FMTSEQ_PRIVKEY_IDENT)) packed = false;
+	else return false;
 
 	sencode_bytes*B;
 	sencode_int*I;
@@ -351,37 +429,13 @@ bool fmtseq::privkey::unserialize (sencode*s)
 	CAST_INT (L->items[5], I);
 	sigs_used = I->i;
 
-	sencode_list*A;
+	//exist and desired subtrees
+	if (!fmtseq_unserialize_trees (L->items[6], exist, h, packed))
+		return false;
+	if (!fmtseq_unserialize_trees (L->items[7], desired, h, packed))
+		return false;
 
-	//exist subtrees
-	CAST_LIST (L->items[6], A);
-	exist.clear();
-	exist.resize (A->items.size());
-	for (i = 0; i < exist.size(); ++i) {
-		sencode_list*CAST_LIST (A->items[i], e);
-		exist[i].resize (e->items.size());
-		for (j = 0; j < exist[i].size(); ++j) {
-			sencode_bytes*CAST_BYTES (e->items[j], item);
-			exist[i][j] = std::vector<byte>
-			              (item->b.begin(),
-			               item->b.end());
-		}
-	}
-
-	//desired subtrees
-	CAST_LIST (L->items[7], A);
-	desired.clear();
-	desired.resize (A->items.size());
-	for (i = 0; i < desired.size(); ++i) {
-		sencode_list*CAST_LIST (A->items[i], d);
-		desired[i].resize (d->items.size());
-		for (j = 0; j < desired[i].size(); ++j) {
-			sencode_bytes*CAST_BYTES (d->items[j], item);
-			desired[i][j] = std::vector<byte>
-			                (item->b.begin(),
-			                 item->b.end());
-		}
-	}
+	sencode_list*A;
 
 	//desired stacks
 	CAST_LIST (L->items[8], A);
@@ -0,0 +1,321 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sha2_many.h"
+
+#include "simd.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if CCR_X86_SIMD
+
+#include <immintrin.h>
+
+/*
+ * Each lane hashes one input; a vector holds the same state or schedule
+ * word of all lanes. All inputs have the same length, so they share the
+ * padding layout and the block count.
+ */
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t K512[80] = {
+	0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full,
+	0xe9b5dba58189dbbcull, 0x3956c25bf348b538ull, 0x59f111f1b605d019ull,
+	0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull, 0xd807aa98a3030242ull,
+	0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+	0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull,
+	0xc19bf174cf692694ull, 0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull,
+	0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull, 0x2de92c6f592b0275ull,
+	0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+	0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full,
+	0xbf597fc7beef0ee4ull, 0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull,
+	0x06ca6351e003826full, 0x142929670a0e6e70ull, 0x27b70a8546d22ffcull,
+	0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+	0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull,
+	0x92722c851482353bull, 0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull,
+	0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull, 0xd192e819d6ef5218ull,
+	0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+	0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull,
+	0x34b0bcb5e19b48a8ull, 0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull,
+	0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull, 0x748f82ee5defb2fcull,
+	0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+	0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull,
+	0xc67178f2e372532bull, 0xca273eceea26619cull, 0xd186b8c721c0c207ull,
+	0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull, 0x06f067aa72176fbaull,
+	0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+	0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull,
+	0x431d67c49c100d4cull, 0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull,
+	0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull
+};
+
+static const uint32_t H256[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint64_t H384[8] = {
+	0xcbbb9d5dc1059ed8ull, 0x629a292a367cd507ull, 0x9159015a3070dd17ull,
+	0x152fecd8f70e5939ull, 0x67332667ffc00b31ull, 0x8eb44a8768581511ull,
+	0xdb0c2e0d64f98fa7ull, 0x47b5481dbefa4fa4ull
+};
+
+static const uint64_t H512[8] = {
+	0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull,
+	0xa54ff53a5f1d36f1ull, 0x510e527fade682d1ull, 0x9b05688c2b3e6c1full,
+	0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+
+/*
+ * Returns pointer to block b (of bs bytes) of the padded input. Whole blocks
+ * are read from the input directly, the padded tail is assembled in tail.
+ */
+static const byte* padded_block (const byte*in, size_t len, size_t b,
+                                 size_t bs, byte*tail)
+{
+	if ( (b + 1) * bs <= len) return in + b * bs;
+	return tail + (b - len / bs) * bs;
+}
+
+//tail of padded input, lenbytes is the size of the length field
+static size_t pad_tail (const byte*in, size_t len, size_t bs,
+                        size_t lenbytes, byte*tail)
+{
+	size_t full = len / bs, rest = len - full * bs,
+	       tailblocks = (rest + 1 + lenbytes > bs) ? 2 : 1;
+
+	memset (tail, 0, tailblocks * bs);
+	memcpy (tail, in + full * bs, rest);
+	tail[rest] = 0x80;
+
+	uint64_t bits = (uint64_t) len * 8;
+	for (size_t i = 0; i < 8; ++i)
+		tail[tailblocks * bs - 1 - i] = (bits >> (8 * i)) & 0xff;
+
+	return full + tailblocks;
+}
+
+static inline uint32_t load_be32 (const byte*p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16
+	       | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static inline uint64_t load_be64 (const byte*p)
+{
+	return (uint64_t) load_be32 (p) << 32 | load_be32 (p + 4);
+}
+
+#define ror32(x,n) _mm256_or_si256 (_mm256_srli_epi32 (x, n), \
+                                    _mm256_slli_epi32 (x, 32 - (n)))
+#define ror64(x,n) _mm256_or_si256 (_mm256_srli_epi64 (x, n), \
+                                    _mm256_slli_epi64 (x, 64 - (n)))
+
+//ch(e,f,g) = g^(e&(f^g)), maj(a,b,c) = (a&b)|(c&(a|b))
+#define sha2_ch(e,f,g) \
+	_mm256_xor_si256 (g, _mm256_and_si256 (e, _mm256_xor_si256 (f, g)))
+#define sha2_maj(a,b,c) \
+	_mm256_or_si256 (_mm256_and_si256 (a, b), \
+	                 _mm256_and_si256 (c, _mm256_or_si256 (a, b)))
+
+//8 inputs of SHA-256, in[] points to the inputs
+CCR_TARGET ("avx2")
+static void sha256_lanes (const byte*const*in, size_t len, byte*const*out)
+{
+	byte tail[8][128];
+	size_t blocks = 0, b;
+	int i, l, t;
+
+	for (l = 0; l < 8; ++l) blocks = pad_tail (in[l], len, 64, 8, tail[l]);
+
+	__m256i s[8], v[8], w[16], t1, t2;
+	for (i = 0; i < 8; ++i) s[i] = _mm256_set1_epi32 (H256[i]);
+
+	for (b = 0; b < blocks; ++b) {
+		uint32_t m[16][8];
+		for (l = 0; l < 8; ++l) {
+			const byte*p = padded_block (in[l], len, b, 64, tail[l]);
+			for (i = 0; i < 16; ++i) m[i][l] = load_be32 (p + 4 * i);
+		}
+		for (i = 0; i < 16; ++i)
+			w[i] = _mm256_loadu_si256 ( (__m256i*) m[i]);
+		for (i = 0; i < 8; ++i) v[i] = s[i];
+
+		for (t = 0; t < 64; ++t) {
+			if (t >= 16) {
+				__m256i w15 = w[ (t + 1) & 15], w2 = w[ (t + 14) & 15];
+				__m256i s0 = _mm256_xor_si256 (
+				                 _mm256_xor_si256 (ror32 (w15, 7), ror32 (w15, 18)),
+				                 _mm256_srli_epi32 (w15, 3));
+				__m256i s1 = _mm256_xor_si256 (
+				                 _mm256_xor_si256 (ror32 (w2, 17), ror32 (w2, 19)),
+				                 _mm256_srli_epi32 (w2, 10));
+				w[t & 15] = _mm256_add_epi32 (
+				                _mm256_add_epi32 (w[t & 15], s0),
+				                _mm256_add_epi32 (w[ (t + 9) & 15], s1));
+			}
+
+			t1 = _mm256_add_epi32 (
+			         _mm256_add_epi32 (v[7], _mm256_xor_si256 (
+			                               _mm256_xor_si256 (ror32 (v[4], 6), ror32 (v[4], 11)),
+			                               ror32 (v[4], 25))),
+			         _mm256_add_epi32 (
+			             _mm256_add_epi32 (sha2_ch (v[4], v[5], v[6]),
+			                               _mm256_set1_epi32 (K256[t])),
+			             w[t & 15]));
+			t2 = _mm256_add_epi32 (
+			         _mm256_xor_si256 (
+			             _mm256_xor_si256 (ror32 (v[0], 2), ror32 (v[0], 13)),
+			             ror32 (v[0], 22)),
+			         sha2_maj (v[0], v[1], v[2]));
+
+			for (i = 7; i > 0; --i) v[i] = v[i - 1];
+			v[4] = _mm256_add_epi32 (v[4], t1);
+			v[0] = _mm256_add_epi32 (t1, t2);
+		}
+
+		for (i = 0; i < 8; ++i) s[i] = _mm256_add_epi32 (s[i], v[i]);
+	}
+
+	uint32_t r[8][8];
+	for (i = 0; i < 8; ++i) _mm256_storeu_si256 ( (__m256i*) r[i], s[i]);
+	for (l = 0; l < 8; ++l)
+		for (i = 0; i < 32; ++i)
+			out[l][i] = (r[i / 4][l] >> (8 * (3 - i % 4))) & 0xff;
+}
+
+//4 inputs of SHA-384/512, digest is the output size
+CCR_TARGET ("avx2")
+static void sha512_lanes (const uint64_t*iv, uint digest,
+                          const byte*const*in, size_t len, byte*const*out)
+{
+	byte tail[4][256];
+	size_t blocks = 0, b;
+	int i, l, t;
+
+	/*
+	 * the length field is 16 bytes, but the upper half stays zero for any
+	 * length that fits into size_t.
+	 */
+	for (l = 0; l < 4; ++l) blocks = pad_tail (in[l], len, 128, 16, tail[l]);
+
+	__m256i s[8], v[8], w[16], t1, t2;
+	for (i = 0; i < 8; ++i) s[i] = _mm256_set1_epi64x (iv[i]);
+
+	for (b = 0; b < blocks; ++b) {
+		uint64_t m[16][4];
+		for (l = 0; l < 4; ++l) {
+			const byte*p = padded_block (in[l], len, b, 128, tail[l]);
+			for (i = 0; i < 16; ++i) m[i][l] = load_be64 (p + 8 * i);
+		}
+		for (i = 0; i < 16; ++i)
+			w[i] = _mm256_loadu_si256 ( (__m256i*) m[i]);
+		for (i = 0; i < 8; ++i) v[i] = s[i];
+
+		for (t = 0; t < 80; ++t) {
+			if (t >= 16) {
+				__m256i w15 = w[ (t + 1) & 15], w2 = w[ (t + 14) & 15];
+				__m256i s0 = _mm256_xor_si256 (
+				                 _mm256_xor_si256 (ror64 (w15, 1), ror64 (w15, 8)),
+				                 _mm256_srli_epi64 (w15, 7));
+				__m256i s1 = _mm256_xor_si256 (
+				                 _mm256_xor_si256 (ror64 (w2, 19), ror64 (w2, 61)),
+				                 _mm256_srli_epi64 (w2, 6));
+				w[t & 15] = _mm256_add_epi64 (
+				                _mm256_add_epi64 (w[t & 15], s0),
+				                _mm256_add_epi64 (w[ (t + 9) & 15], s1));
+			}
+
+			t1 = _mm256_add_epi64 (
+			         _mm256_add_epi64 (v[7], _mm256_xor_si256 (
+			                               _mm256_xor_si256 (ror64 (v[4], 14), ror64 (v[4], 18)),
+			                               ror64 (v[4], 41))),
+			         _mm256_add_epi64 (
+			             _mm256_add_epi64 (sha2_ch (v[4], v[5], v[6]),
+			                               _mm256_set1_epi64x (K512[t])),
+			             w[t & 15]));
+			t2 = _mm256_add_epi64 (
+			         _mm256_xor_si256 (
+			             _mm256_xor_si256 (ror64 (v[0], 28), ror64 (v[0], 34)),
+			             ror64 (v[0], 39)),
+			         sha2_maj (v[0], v[1], v[2]));
+
+			for (i = 7; i > 0; --i) v[i] = v[i - 1];
+			v[4] = _mm256_add_epi64 (v[4], t1);
+			v[0] = _mm256_add_epi64 (t1, t2);
+		}
+
+		for (i = 0; i < 8; ++i) s[i] = _mm256_add_epi64 (s[i], v[i]);
+	}
+
+	uint64_t r[8][4];
+	for (i = 0; i < 8; ++i) _mm256_storeu_si256 ( (__m256i*) r[i], s[i]);
+	for (l = 0; l < 4; ++l)
+		for (i = 0; i < (int) digest; ++i)
+			out[l][i] = (r[i / 8][l] >> (8 * (7 - i % 8))) & 0xff;
+}
+
+#endif //CCR_X86_SIMD
+
+bool sha2_many (uint digest, const byte*in, size_t len, size_t n, byte*out)
+{
+#if CCR_X86_SIMD
+	static bool avx2 = cpu_has_avx2();
+	if (!avx2) return false;
+	if (digest != 32 && digest != 48 && digest != 64) return false;
+
+	uint L = digest == 32 ? 8 : 4;
+
+	/*
+	 * incomplete last group is filled up by repeating the last input, the
+	 * extra results go to a scratch buffer.
+	 */
+	byte scratch[8][64];
+	const byte*ip[8];
+	byte*op[8];
+
+	for (size_t done = 0; done < n; done += L) {
+		for (uint l = 0; l < L; ++l) {
+			size_t i = done + l < n ? done + l : n - 1;
+			ip[l] = in + i * len;
+			op[l] = done + l < n ? out + i * digest : scratch[l];
+		}
+		if (digest == 32) sha256_lanes (ip, len, op);
+		else sha512_lanes (digest == 48 ? H384 : H512, digest,
+			                   ip, len, op);
+	}
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,37 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ccr_sha2_many_h_
+#define _ccr_sha2_many_h_
+
+#include "types.h"
+
+#include <stddef.h>
+
+/*
+ * SHA-2 of n independent inputs of len bytes each (stored one after
+ * another), computed in vector lanes. digest is the output size in bytes and
+ * selects the function (32 for SHA-256, 48 for SHA-384, 64 for SHA-512).
+ * Returns false if there is no vector implementation for the CPU; the
+ * caller is then expected to hash the inputs one by one.
+ */
+bool sha2_many (uint digest, const byte*in, size_t len, size_t n, byte*out);
+
+#endif
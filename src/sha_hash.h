@@ -24,12 +24,30 @@
 #if HAVE_CRYPTOPP==1
 
 #include "hash.h"
+#include "sha2_many.h"
 #if CRYPTOPP_DIR_PLUS
 #  include <crypto++/sha.h>
 #else
 #  include <cryptopp/sha.h>
 #endif
 
+/*
+ * marks the types that sha2_many can compute (this template also serves
+ * RIPEMD and Tiger)
+ */
+template <class shatype> struct sha2_lanes {
+	static const bool value = false;
+};
+template <> struct sha2_lanes<CryptoPP::SHA256> {
+	static const bool value = true;
+};
+template <> struct sha2_lanes<CryptoPP::SHA384> {
+	static const bool value = true;
+};
+template <> struct sha2_lanes<CryptoPP::SHA512> {
+	static const bool value = true;
+};
+
 template <class shatype>
 class shahash : public hash_func
 {
@@ -38,13 +56,14 @@ public:
 		return shatype::DIGESTSIZE;
 	}
 
-	std::vector<byte> operator() (const std::vector<byte>&a) {
-		std::vector<byte> r;
-		r.resize (size());
-		shatype().CalculateDigest (& (r[0]),
-		                           & (a[0]),
-		                           a.size());
-		return r;
+	void hash (const byte*a, size_t len, byte*out) {
+		shatype().CalculateDigest (out, a, len);
+	}
+
+	void hash_many (const byte*in, size_t len, size_t n, byte*out) {
+		if (!sha2_lanes<shatype>::value
+		    || !sha2_many (size(), in, len, n, out))
+			hash_func::hash_many (in, len, n, out);
 	}
 };
 
@@ -69,11 +88,8 @@ public:
 		state.Update (a, aend - a);
 	}
 
-	std::vector<byte> finish() {
-		std::vector<byte> r;
-		r.resize (size());
-		state.Final (& (r[0]));
-		return r;
+	void finish (byte*out) {
+		state.Final (out);
 	}
 };
 
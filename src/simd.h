@@ -0,0 +1,75 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ccr_simd_h_
+#define _ccr_simd_h_
+
+/*
+ * Runtime detection of x86 vector extensions.
+ *
+ * Kernels that use the extensions are compiled with per-function target
+ * attributes, so that the binary stays portable and the fast variants get
+ * picked at runtime. On other architectures (or compilers) only the portable
+ * kernels are built.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+#define CCR_X86_SIMD 1
+#define CCR_TARGET(x) __attribute__ ((target (x)))
+
+inline bool cpu_has_sse2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports ("sse2");
+}
+
+inline bool cpu_has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports ("avx2");
+}
+
+inline bool cpu_has_avx512()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports ("avx512f");
+}
+
+inline bool cpu_has_pclmul()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports ("pclmul");
+}
+
+inline bool cpu_has_vpclmul()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports ("avx512f")
+	       && __builtin_cpu_supports ("vpclmulqdq");
+}
+
+#else
+
+#define CCR_X86_SIMD 0
+
+#endif
+
+#endif
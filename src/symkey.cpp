@@ -197,6 +197,344 @@ bool symkey::save (const std::string&fn, const std::string&withlock,
 typedef std::list<instanceof<streamcipher> > scs_t;
 typedef std::list<instanceof<hash_proc> > hashes_t;
 
+static bool symkey_ciphers (const symkey&sk, const std::vector<byte>&otkey,
+                            scs_t&scs)
+{
+	for (std::set<std::string>::const_iterator
+	     i = sk.ciphers.begin(), e = sk.ciphers.end();
+	     i != e; ++i) {
+		if (!streamcipher::suite().count (*i)) {
+			err ("symkey: unsupported cipher: " << escape_output (*i));
+			return false;
+		}
+		scs.push_back (streamcipher::suite() [*i]->get());
+		scs.back().collect();
+		scs.back()->init();
+		scs.back()->load_key_vector (sk.key);
+		scs.back()->load_key_vector (otkey);
+	}
+	return true;
+}
+
+static bool symkey_hashes (const symkey&sk, hashes_t&hs, uint&hashes_size)
+{
+	hashes_size = 0;
+	for (std::set<std::string>::const_iterator
+	     i = sk.hashes.begin(), e = sk.hashes.end();
+	     i != e; ++i) {
+		if (!hash_proc::suite().count (*i)) {
+			err ("symkey: unsupported hash function: " << escape_output (*i));
+			return false;
+		}
+		hs.push_back (hash_proc::suite() [*i]->get());
+		hs.back().collect();
+
+		hashes_size += hs.back()->size();
+	}
+	return true;
+}
+
+/*
+ * Pipelined processing, used when more threads are allowed. Blocks go in
+ * batches through two buffers: the calling thread reads a batch and hashes
+ * its blocks in the thread pool, while another thread finishes and writes
+ * the previous batch. Chacha20 can jump in its keystream, so its keystream
+ * for a batch is generated in the pool too, in chunks. Other ciphers (xsynd
+ * and arcfour can't seek) run over the blocks in order on a single thread.
+ * The output is exactly the same as from the serial loop.
+ */
+
+#include "chacha.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <thread>
+
+struct symkey_batch {
+	std::vector<byte> buf;
+	std::vector<uint> len; //data bytes of each block, without hashes
+	std::vector<char> bad; //decryption: mismatch of each block hash
+	size_t n;
+	bool last;
+};
+
+class symkey_hasher
+{
+	thread_pool&pool;
+	std::vector<instanceof<hash_proc> > hps;
+	std::vector<uint> offset; //of each hash behind the block data
+	const std::vector<byte>&key, &otkey;
+public:
+	uint hashes_size;
+
+	symkey_hasher (thread_pool&p, const std::set<std::string>&hashes,
+	               const std::vector<byte>&k, const std::vector<byte>&ok)
+		: pool (p), key (k), otkey (ok) {
+		//each pool thread hashes its chunk of blocks with own instances
+		hps.resize (pool.size() * hashes.size());
+		hashes_size = 0;
+		for (std::set<std::string>::const_iterator
+		     i = hashes.begin(), e = hashes.end(); i != e; ++i) {
+			offset.push_back (hashes_size);
+			for (size_t j = offset.size() - 1; j < hps.size();
+			     j += hashes.size()) {
+				hps[j] = instanceof<hash_proc>
+				         (hash_proc::suite() [*i]->get());
+				hps[j].collect();
+			}
+			hashes_size += hps[offset.size() - 1]->size();
+		}
+	}
+
+	//computes (or checks, for decryption) the hashes of all batch blocks
+	void run (symkey_batch&b, size_t stride, bool check) {
+		size_t nh = offset.size(), chunks = pool.size();
+		if (chunks > b.n) chunks = b.n;
+		b.bad.assign (b.n * nh, 0);
+
+		pool.run (chunks * nh, [&] (size_t job) {
+			hash_proc&hp = *hps[job];
+			size_t h = job % nh, c = job / nh;
+			std::vector<byte> res (hp.size());
+			for (size_t i = c * b.n / chunks;
+			     i < (c + 1) * b.n / chunks; ++i) {
+				byte*blk = & (b.buf[i * stride]);
+				hp.init();
+				hp.eat (blk, blk + b.len[i]);
+				hp.eat (key);
+				hp.eat (otkey);
+				hp.finish (res.data());
+				byte*dst = blk + b.len[i] + offset[h];
+				if (!check)
+					std::copy (res.begin(), res.end(), dst);
+				else if (!std::equal (res.begin(), res.end(), dst))
+					b.bad[i * nh + h] = 1;
+			}
+		});
+	}
+
+	bool block_ok (const symkey_batch&b, size_t i) {
+		for (size_t h = 0; h < offset.size(); ++h)
+			if (b.bad[i * offset.size() + h]) return false;
+		return true;
+	}
+};
+
+/*
+ * blocks per batch, so that even short blocks make reasonable pool jobs.
+ * Batch memory is limited regardless of the thread count (there are two
+ * batches), long blocks get less parallel hashing instead.
+ */
+#define SYMKEY_BATCH_MIN (1 << 20)
+#define SYMKEY_BATCH_MAX (256 << 20)
+
+static size_t symkey_batch_blocks (uint blocksize, uint threads)
+{
+	size_t n = SYMKEY_BATCH_MIN / blocksize;
+	if (n < threads) n = threads;
+	if (n > SYMKEY_BATCH_MAX / blocksize) n = SYMKEY_BATCH_MAX / blocksize;
+	if (!n) n = 1;
+	return n;
+}
+
+//smallest keystream piece worth a pool job
+#define SYMKEY_XOR_CHUNK (64 << 10)
+
+/*
+ * xors the keystreams into the data. Chacha20 jobs work on copies of the
+ * cipher that are moved to their chunk, the cipher itself is then moved
+ * behind the data.
+ */
+static void symkey_xor_seekable (scs_t&scs, byte*data, size_t size,
+                                 thread_pool&pool)
+{
+	size_t chunks = size / SYMKEY_XOR_CHUNK;
+	if (chunks > pool.size()) chunks = pool.size();
+
+	for (scs_t::iterator i = scs.begin(), e = scs.end(); i != e; ++i) {
+		chacha20*c = dynamic_cast<chacha20*> (& **i);
+		if (!c) continue;
+		if (chunks < 2) {
+			c->xor_into (data, size);
+			continue;
+		}
+
+		pool.run (chunks, [&] (size_t job) {
+			//chunks are made of whole keystream blocks
+			size_t blocks = size / 64,
+			       from = blocks * job / chunks * 64,
+			       to = job + 1 < chunks ?
+			            blocks * (job + 1) / chunks * 64 : size;
+			chacha20 cc = *c;
+			cc.discard (from);
+			cc.xor_into (data + from, to - from);
+		});
+		c->discard (size);
+	}
+}
+
+static void symkey_xor_serial (scs_t&scs, byte*data, size_t size)
+{
+	for (scs_t::iterator i = scs.begin(), e = scs.end(); i != e; ++i)
+		if (!dynamic_cast<chacha20*> (& **i))
+			(*i)->xor_into (data, size);
+}
+
+static bool symkey_encrypt_pipelined (const symkey&sk,
+                                      const std::vector<byte>&otkey,
+                                      scs_t&scs, std::istream&in,
+                                      std::ostream&out, uint threads)
+{
+	thread_pool pool (threads);
+	symkey_hasher hasher (pool, sk.hashes, sk.key, otkey);
+	size_t stride = sk.blocksize + hasher.hashes_size,
+	       nblocks = symkey_batch_blocks (sk.blocksize, pool.size());
+
+	//buffers grow as needed, short inputs don't need whole batches
+	symkey_batch batches[2];
+	for (int i = 0; i < 2; ++i)
+		batches[i].len.resize (nblocks);
+
+	std::thread writer;
+	bool write_ok = true;
+
+	for (int cur = 0;; cur ^= 1) {
+		symkey_batch&b = batches[cur];
+
+		//read
+		b.last = false;
+		for (b.n = 0; b.n < nblocks && !b.last; ++b.n) {
+			if (b.buf.size() < (b.n + 1) * stride)
+				b.buf.resize ( (b.n + 1) * stride);
+			in.read ( (char*) & (b.buf[b.n * stride]), sk.blocksize);
+			b.len[b.n] = in.gcount();
+			if (!in && !in.eof()) break;
+			b.last = b.len[b.n] < sk.blocksize;
+		}
+
+		if (!in && !in.eof()) {
+			if (writer.joinable()) writer.join();
+			err ("symkey: failed reading input");
+			return false;
+		}
+
+		//hashup!
+		hasher.run (b, stride, false);
+
+		//encrypt, finish and output in the background
+		size_t size = (b.n - 1) * stride + b.len[b.n - 1]
+		              + stride - sk.blocksize;
+		symkey_xor_seekable (scs, & (b.buf[0]), size, pool);
+
+		if (writer.joinable()) writer.join();
+		if (!write_ok) break;
+		writer = std::thread ([&, cur, size] {
+			symkey_batch&b = batches[cur];
+			symkey_xor_serial (scs, & (b.buf[0]), size);
+
+			out.write ( (char*) & (b.buf[0]), size);
+			if (!out) write_ok = false;
+		});
+
+		if (b.last) break;
+	}
+
+	if (writer.joinable()) writer.join();
+	if (!write_ok) {
+		err ("symkey: failed to write output");
+		return false;
+	}
+
+	return true;
+}
+
+static int symkey_decrypt_pipelined (const symkey&sk,
+                                     const std::vector<byte>&otkey,
+                                     scs_t&scs, std::istream&in,
+                                     std::ostream&out, uint threads)
+{
+	thread_pool pool (threads);
+	symkey_hasher hasher (pool, sk.hashes, sk.key, otkey);
+	size_t stride = sk.blocksize + hasher.hashes_size,
+	       nblocks = symkey_batch_blocks (sk.blocksize, pool.size());
+
+	//buffers grow as needed, short inputs don't need whole batches
+	symkey_batch batches[2];
+	for (int i = 0; i < 2; ++i)
+		batches[i].len.resize (nblocks);
+
+	std::thread writer;
+	int ret = 0;
+
+	for (int cur = 0;; cur ^= 1) {
+		symkey_batch&b = batches[cur];
+
+		//read
+		bool read_ok = true;
+		b.last = false;
+		for (b.n = 0; b.n < nblocks && !b.last; ++b.n) {
+			if (b.buf.size() < (b.n + 1) * stride)
+				b.buf.resize ( (b.n + 1) * stride);
+			in.read ( (char*) & (b.buf[b.n * stride]), stride);
+			uint bytes_read = in.gcount();
+
+			if ( (!in && !in.eof())
+			     || bytes_read < hasher.hashes_size) {
+				read_ok = false;
+				break;
+			}
+
+			b.len[b.n] = bytes_read - hasher.hashes_size;
+			b.last = b.len[b.n] < sk.blocksize;
+		}
+
+		//decrypt and verify the hashes of the complete blocks
+		if (b.n) {
+			size_t size = (b.n - 1) * stride + b.len[b.n - 1]
+			              + hasher.hashes_size;
+			symkey_xor_seekable (scs, & (b.buf[0]), size, pool);
+			symkey_xor_serial (scs, & (b.buf[0]), size);
+			hasher.run (b, stride, true);
+		}
+
+		//output the correct blocks, stop at the first bad one
+		size_t good;
+		for (good = 0; good < b.n && hasher.block_ok (b, good); ++good);
+
+		if (writer.joinable()) writer.join();
+		writer = std::thread ([&, cur, good] {
+			symkey_batch&b = batches[cur];
+			for (size_t i = 0; i < good; ++i)
+				out.write ( (char*) & (b.buf[i * stride]),
+				            b.len[i]);
+		});
+
+		if (good < b.n) {
+			err ("symkey: mangled input");
+			ret = 3;
+			break;
+		}
+
+		if (!read_ok) {
+			err ("symkey: failed reading input");
+			ret = 1;
+			break;
+		}
+
+		if (b.last) break;
+	}
+
+	if (writer.joinable()) writer.join();
+	if (ret) return ret;
+
+	//did we read whole input?
+	if (!in.eof()) {
+		err ("symkey: failed reading input");
+		return 1;
+	}
+	return 0;
+}
+
 bool symkey::encrypt (std::istream&in, std::ostream&out, prng&rng)
 {
 	if (!is_valid()) return false;
@@ -223,39 +561,15 @@ bool symkey::encrypt (std::istream&in, std::ostream&out, prng&rng)
 	 */
 
 	scs_t scs;
-	for (std::set<std::string>::iterator
-	     i = ciphers.begin(), e = ciphers.end();
-	     i != e; ++i) {
-		if (!streamcipher::suite().count (*i)) {
-			err ("symkey: unsupported cipher: " << escape_output (*i));
-			return false;
-		}
-		scs.push_back (streamcipher::suite() [*i]->get());
-		scs.back().collect();
-		scs.back()->init();
-		scs.back()->load_key_vector (key);
-		scs.back()->load_key_vector (otkey);
-	}
+	if (!symkey_ciphers (*this, otkey, scs)) return false;
 
 	/*
 	 * initialize the hashes
 	 */
 
-	uint hashes_size = 0;
-
+	uint hashes_size;
 	hashes_t hs;
-	for (std::set<std::string>::iterator
-	     i = hashes.begin(), e = hashes.end();
-	     i != e; ++i) {
-		if (!hash_proc::suite().count (*i)) {
-			err ("symkey: unsupported hash function: " << escape_output (*i));
-			return false;
-		}
-		hs.push_back (hash_proc::suite() [*i]->get());
-		hs.back().collect();
-
-		hashes_size += hs.back()->size();
-	}
+	if (!symkey_hashes (*this, hs, hashes_size)) return false;
 
 	/*
 	 * output the onetime key
@@ -267,9 +581,13 @@ bool symkey::encrypt (std::istream&in, std::ostream&out, prng&rng)
 	 * process the blocks
 	 */
 
-	std::vector<byte>buf, cipbuf;
+	uint threads = default_threads();
+	if (threads != 1)
+		return symkey_encrypt_pipelined (*this, otkey, scs,
+		                                 in, out, threads);
+
+	std::vector<byte>buf;
 	buf.resize (blocksize + hashes_size);
-	cipbuf.resize (buf.size());
 
 	for (;;) {
 		in.read ( (char*) & (buf[0]), blocksize);
@@ -299,9 +617,7 @@ bool symkey::encrypt (std::istream&in, std::ostream&out, prng&rng)
 		for (scs_t::iterator i = scs.begin(), e = scs.end();
 		     i != e; ++i) {
 			streamcipher&sc = **i;
-			sc.gen (hashpos, & (cipbuf[0]));
-			for (uint j = 0; j < hashpos; ++j)
-				buf[j] = buf[j] ^ cipbuf[j];
+			sc.xor_into (& (buf[0]), hashpos);
 		}
 
 		//output!
@@ -340,47 +656,27 @@ int symkey::decrypt (std::istream&in, std::ostream&out)
 	 */
 
 	scs_t scs;
-	for (std::set<std::string>::iterator
-	     i = ciphers.begin(), e = ciphers.end();
-	     i != e; ++i) {
-		if (!streamcipher::suite().count (*i)) {
-			err ("symkey: unsupported cipher: " << escape_output (*i));
-			return 1;
-		}
-		scs.push_back (streamcipher::suite() [*i]->get());
-		scs.back().collect();
-		scs.back()->init();
-		scs.back()->load_key_vector (key);
-		scs.back()->load_key_vector (otkey);
-	}
+	if (!symkey_ciphers (*this, otkey, scs)) return 1;
 
 	/*
 	 * initialize the hashes
 	 */
 
-	uint hashes_size = 0;
-
+	uint hashes_size;
 	hashes_t hs;
-	for (std::set<std::string>::iterator
-	     i = hashes.begin(), e = hashes.end();
-	     i != e; ++i) {
-		if (!hash_proc::suite().count (*i)) {
-			err ("symkey: unsupported hash function: " << escape_output (*i));
-			return 1;
-		}
-		hs.push_back (hash_proc::suite() [*i]->get());
-		hs.back().collect();
-
-		hashes_size += hs.back()->size();
-	}
+	if (!symkey_hashes (*this, hs, hashes_size)) return 1;
 
 	/*
 	 * process the blocks
 	 */
 
-	std::vector<byte> buf, cipbuf;
+	uint threads = default_threads();
+	if (threads != 1)
+		return symkey_decrypt_pipelined (*this, otkey, scs,
+		                                 in, out, threads);
+
+	std::vector<byte> buf;
 	buf.resize (blocksize + hashes_size);
-	cipbuf.resize (buf.size());
 
 	for (;;) {
 		in.read ( (char*) & (buf[0]), buf.size());
@@ -395,9 +691,7 @@ int symkey::decrypt (std::istream&in, std::ostream&out)
 		for (scs_t::iterator i = scs.begin(), e = scs.end();
 		     i != e; ++i) {
 			streamcipher&sc = **i;
-			sc.gen (bytes_read, & (cipbuf[0]));
-			for (uint j = 0; j < bytes_read; ++j)
-				buf[j] = buf[j] ^ cipbuf[j];
+			sc.xor_into (& (buf[0]), bytes_read);
 		}
 
 		bytes_read -= hashes_size;
@@ -433,3 +727,129 @@ int symkey::decrypt (std::istream&in, std::ostream&out)
 	}
 	return 0;
 }
+
+int symkey::decrypt_range (std::istream&in, std::ostream&out,
+                           uint64_t from, uint64_t to)
+{
+	if (!is_valid()) return 1;
+
+	std::vector<byte> otkey;
+	otkey.resize (key.size());
+
+	in.read ( (char*) & (otkey[0]), otkey.size());
+	if (in.gcount() != (std::streamsize) otkey.size() || !in) {
+		err ("symkey: failed reading input");
+		return 1;
+	}
+
+	scs_t scs;
+	if (!symkey_ciphers (*this, otkey, scs)) return 1;
+
+	uint hashes_size;
+	hashes_t hs;
+	if (!symkey_hashes (*this, hs, hashes_size)) return 1;
+
+	if (from >= to) return 0;
+
+	/*
+	 * Jump to the first block of the range, in the input and in the
+	 * keystreams. Chacha20 skips keystream blocks just by moving the
+	 * counter, other ciphers have to generate the skipped keystream.
+	 * Inputs that can't seek are read through.
+	 *
+	 * If the range starts behind the end of the data, the last block is
+	 * used instead, so that the end of the stream still gets verified and
+	 * the output is empty.
+	 */
+
+	uint64_t stride = blocksize + hashes_size,
+	         block = from / blocksize;
+
+	std::vector<byte> buf;
+	buf.resize (stride);
+	bool have_block = false;
+	uint bytes_read = 0;
+
+	in.seekg (0, std::ios::end);
+	std::streamoff size = in.tellg();
+	if (in) {
+		uint64_t len = size - otkey.size();
+		if (len && block > (len - 1) / stride)
+			block = (len - 1) / stride;
+		in.seekg (otkey.size() + block * stride, std::ios::beg);
+	} else {
+		in.clear();
+		for (uint64_t b = 0; b < block; ++b) {
+			in.read ( (char*) & (buf[0]), stride);
+			if (in.gcount() == (std::streamsize) stride) continue;
+			if (!in.eof()) {
+				err ("symkey: failed reading input");
+				return 1;
+			}
+			block = b;
+			bytes_read = in.gcount();
+			have_block = true;
+			break;
+		}
+	}
+
+	for (scs_t::iterator i = scs.begin(), e = scs.end(); i != e; ++i)
+		for (uint64_t left = block * stride; left;) {
+			size_t n = left > (1 << 30) ? (1 << 30) : left;
+			(*i)->discard (n);
+			left -= n;
+		}
+
+	/*
+	 * decrypt and verify only the blocks that overlap the range. Note
+	 * that the rest of the stream isn't checked at all, so e.g. data
+	 * truncated behind the range are not detected.
+	 */
+
+	for (; block * blocksize < to; ++block) {
+		if (have_block) have_block = false;
+		else {
+			in.read ( (char*) & (buf[0]), buf.size());
+			bytes_read = in.gcount();
+		}
+
+		if ( (!in && !in.eof()) || bytes_read < hashes_size) {
+			err ("symkey: failed reading input");
+			return 1;
+		}
+
+		for (scs_t::iterator i = scs.begin(), e = scs.end();
+		     i != e; ++i)
+			(*i)->xor_into (& (buf[0]), bytes_read);
+
+		bytes_read -= hashes_size;
+
+		uint hashpos = bytes_read;
+		for (hashes_t::iterator i = hs.begin(), e = hs.end();
+		     i != e; ++i) {
+			hash_proc&hp = **i;
+			hp.init();
+			hp.eat (& (buf[0]), & (buf[bytes_read]));
+			hp.eat (key);
+			hp.eat (otkey);
+			std::vector<byte> res = hp.finish();
+			for (uint j = 0; j < res.size(); ++j, ++hashpos)
+				if (buf[hashpos] != res[j]) {
+					err ("symkey: mangled input");
+					return 3;
+				}
+		}
+
+		//output the part of the block that is in range
+		uint64_t start = block * blocksize, begin = 0, end = bytes_read;
+		if (from > start) begin = from - start;
+		if (to - start < end) end = to - start;
+		if (begin < end)
+			out.write ( (char*) & (buf[begin]), end - begin);
+
+		//last block
+		if (bytes_read < blocksize) break;
+	}
+
+	return 0;
+}
@@ -27,6 +27,8 @@
 #include <set>
 #include <vector>
 
+#include <stdint.h>
+
 #include "types.h"
 #include "prng.h"
 #include "sencode.h"
@@ -46,6 +48,13 @@ public:
 	bool encrypt (std::istream&, std::ostream&, prng&);
 	int decrypt (std::istream&, std::ostream&);
 
+	/*
+	 * decrypts only the plaintext bytes from..to-1, verifying just the
+	 * blocks that contain them. Input should be seekable.
+	 */
+	int decrypt_range (std::istream&, std::ostream&,
+	                   uint64_t from, uint64_t to);
+
 	bool is_valid();
 	bool create (const std::string&, prng&);
 
@@ -0,0 +1,100 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpool.h"
+
+thread_pool::thread_pool (uint threads)
+	: job (NULL), job_count (0), next_job (0), unfinished (0),
+	  generation (0), quit (false)
+{
+	if (!threads) threads = std::thread::hardware_concurrency();
+	//the caller of run() works too
+	for (uint i = 1; i < threads; ++i)
+		workers.push_back (std::thread (&thread_pool::worker, this));
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::unique_lock<std::mutex> l (lock);
+		quit = true;
+	}
+	work_cv.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+}
+
+//process jobs until there are none left, with lock held on entry and exit
+void thread_pool::work (std::unique_lock<std::mutex>&l)
+{
+	while (next_job < job_count) {
+		size_t i = next_job++;
+		l.unlock();
+		(*job) (i);
+		l.lock();
+		if (! (--unfinished)) done_cv.notify_all();
+	}
+}
+
+void thread_pool::worker()
+{
+	std::unique_lock<std::mutex> l (lock);
+	uint64_t seen = generation;
+	for (;;) {
+		work_cv.wait (l, [&] {
+			return quit || generation != seen;
+		});
+		if (quit) return;
+		seen = generation;
+		work (l);
+	}
+}
+
+void thread_pool::run (size_t n, const std::function<void (size_t)>&j)
+{
+	if (!n) return;
+
+	std::unique_lock<std::mutex> rl (run_lock);
+	std::unique_lock<std::mutex> l (lock);
+	job = &j;
+	job_count = n;
+	next_job = 0;
+	unfinished = n;
+	++generation;
+	work_cv.notify_all();
+
+	work (l);
+	done_cv.wait (l, [&] {
+		return !unfinished;
+	});
+	job = NULL;
+	job_count = 0;
+}
+
+static uint default_thread_count = 1;
+
+void set_default_threads (uint threads)
+{
+	default_thread_count = threads;
+}
+
+uint default_threads()
+{
+	return default_thread_count;
+}
@@ -0,0 +1,73 @@
+
+/*
+ * This file is part of Codecrypt.
+ *
+ * Copyright (C) 2013-2016 Mirek Kratochvil <exa.exa@gmail.com>
+ *
+ * Codecrypt is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * Codecrypt is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Codecrypt. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ccr_threadpool_h_
+#define _ccr_threadpool_h_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+/*
+ * Simple pool of worker threads for data-parallel loops.
+ *
+ * run(n, job) calls job(i) for all i from 0 to n-1, spread over the workers
+ * and the calling thread, and returns when all are done. Jobs must not depend
+ * on the order of execution. One pool runs one loop at a time.
+ */
+
+class thread_pool
+{
+	std::vector<std::thread> workers;
+	std::mutex lock, run_lock;
+	std::condition_variable work_cv, done_cv;
+
+	const std::function<void (size_t)>*job;
+	size_t job_count, next_job, unfinished;
+	uint64_t generation;
+	bool quit;
+
+	void worker();
+	void work (std::unique_lock<std::mutex>&);
+
+public:
+	//threads = 0 means all available cores
+	explicit thread_pool (uint threads = 0);
+	~thread_pool();
+
+	uint size() {
+		return workers.size() + 1;
+	}
+
+	void run (size_t n, const std::function<void (size_t)>&job);
+};
+
+/*
+ * thread count used by operations that can run in parallel, as set by the
+ * user (0 = all cores). Defaults to 1, which keeps everything serial.
+ */
+void set_default_threads (uint threads);
+uint default_threads();
+
+#endif
@@ -20,48 +20,11 @@
 
 #include "xsynd.h"
 
-//computes Y=Phi(X)*A. Array sizes are fixed to 512, 16, 16.
-static void xsynd_multiply (const uint64_t*A, const uint64_t*X, uint64_t*Y)
-{
-	int i, j;
-
-	//ensure this is unsigned!
-	const byte*Xreg = (const byte*) X;
+#include "simd.h"
 
-	//clear space for the result
-	for (i = 0; i < 16; ++i) Y[i] = 0;
-
-	//cycle through all word-regular parts
-	for (i = 0; i < 128; ++i) {
-		int col = 128 * i + Xreg[i],
-		    qc = col / 1024, //qc block
-		    qcoff = qc * (1024 / 64), //block offset
-		    rot = col % 1024, //rotation in the block
-		    wrot = rot / 64, //rotate words
-		    brot = rot % 64; //rotate bits
-
-		//make the shifted word from two parts
-		// [......(oo][oooooo)..][........]
-		for (j = 0; j < 16; ++j)
-			Y[j] = Y[j] ^ (
-			           (A[qcoff + ( (j + wrot) % 16)]
-			            >> brot)
-			           |
-			           (A[qcoff + ( (j + wrot + 1) % 16)]
-			            << (64 - brot))
-			       );
-	}
-}
-
-//sizes: 512, 512, 16, 16. If R2==NULL, don't output anything.
-static void xsynd_round (const uint64_t*A1, const uint64_t*A2,
-                         uint64_t*R1, uint64_t*R2)
-{
-	if (R2) xsynd_multiply (A2, R1, R2);
-	uint64_t tmp[16];
-	for (int i = 0; i < 16; ++i) tmp[i] = R1[i];
-	xsynd_multiply (A1, tmp, R1);
-}
+#if CCR_X86_SIMD
+#include <immintrin.h>
+#endif
 
 /*
  * A1 and A2 matrices. A1 is binary representation of fractional part of
@@ -416,6 +379,113 @@ const uint64_t CA2[512] = {
 	0x42ef1cf26ef68537, 0x0b5820c47d832f94
 };
 
+/*
+ * The multiplication engine. Every 1024bit QC block of A is stored twice in a
+ * row, so that the rotated block can be read as 16 consecutive (two-word
+ * shifted) words without any modulo. Tables are 16kB each, built once.
+ */
+
+struct xsynd_matrix {
+	uint64_t d[32][32];
+
+	xsynd_matrix (const uint64_t*A) {
+		for (int b = 0; b < 32; ++b)
+			for (int j = 0; j < 32; ++j)
+				d[b][j] = A[16 * b + j % 16];
+	}
+};
+
+static const xsynd_matrix& xsynd_A1()
+{
+	static xsynd_matrix m (CA1);
+	return m;
+}
+
+static const xsynd_matrix& xsynd_A2()
+{
+	static xsynd_matrix m (CA2);
+	return m;
+}
+
+/*
+ * Column i of Phi(X) selects the block and rotation of A. Zero bit rotation
+ * gets the left shift by 64 that the original code did, which x86 performs
+ * as a shift by 0; that is kept for compatibility of the keystream.
+ */
+#define xsynd_column(i) \
+	int col = 128 * i + Xreg[i], \
+	    rot = col % 1024, \
+	    brot = rot % 64, \
+	    lrot = (64 - brot) % 64; \
+	const uint64_t*a = A.d[col / 1024] + rot / 64;
+
+static void xsynd_multiply_generic (const xsynd_matrix&A, const uint64_t*X,
+                                    uint64_t*Y)
+{
+	int i, j;
+
+	//ensure this is unsigned!
+	const byte*Xreg = (const byte*) X;
+
+	for (j = 0; j < 16; ++j) Y[j] = 0;
+
+	for (i = 0; i < 128; ++i) {
+		xsynd_column (i);
+		for (j = 0; j < 16; ++j)
+			Y[j] ^= (a[j] >> brot) | (a[j + 1] << lrot);
+	}
+}
+
+#if CCR_X86_SIMD
+CCR_TARGET ("avx2")
+static void xsynd_multiply_avx2 (const xsynd_matrix&A, const uint64_t*X,
+                                 uint64_t*Y)
+{
+	int i, j;
+	const byte*Xreg = (const byte*) X;
+	__m256i y[4];
+
+	for (j = 0; j < 4; ++j) y[j] = _mm256_setzero_si256();
+
+	for (i = 0; i < 128; ++i) {
+		xsynd_column (i);
+		__m128i r = _mm_cvtsi32_si128 (brot), l = _mm_cvtsi32_si128 (lrot);
+		for (j = 0; j < 4; ++j)
+			y[j] = _mm256_xor_si256 (y[j], _mm256_or_si256 (
+			                             _mm256_srl_epi64 (_mm256_loadu_si256 (
+			                                     (__m256i*) (a + 4 * j)), r),
+			                             _mm256_sll_epi64 (_mm256_loadu_si256 (
+			                                     (__m256i*) (a + 4 * j + 1)), l)));
+	}
+
+	for (j = 0; j < 4; ++j)
+		_mm256_storeu_si256 ( (__m256i*) (Y + 4 * j), y[j]);
+}
+#endif
+
+//computes Y=Phi(X)*A. Array sizes are fixed to 512, 16, 16.
+static void xsynd_multiply (const xsynd_matrix&A, const uint64_t*X,
+                            uint64_t*Y)
+{
+#if CCR_X86_SIMD
+	static bool avx2 = cpu_has_avx2();
+	if (avx2) {
+		xsynd_multiply_avx2 (A, X, Y);
+		return;
+	}
+#endif
+	xsynd_multiply_generic (A, X, Y);
+}
+
+//sizes: 512, 512, 16, 16. If R2==NULL, don't output anything.
+static void xsynd_round (uint64_t*R1, uint64_t*R2)
+{
+	if (R2) xsynd_multiply (xsynd_A2(), R1, R2);
+	uint64_t tmp[16];
+	for (int i = 0; i < 16; ++i) tmp[i] = R1[i];
+	xsynd_multiply (xsynd_A1(), tmp, R1);
+}
+
 void xsynd::init()
 {
 	int i;
@@ -449,9 +519,9 @@ void xsynd::load_key (const byte*begin, const byte*end)
 	}
 
 	//run the XIni
-	xsynd_multiply (CA1, R1, Y);
+	xsynd_multiply (xsynd_A1(), R1, Y);
 	for (int i = 0; i < 16; ++i) Y[i] = R1[i] ^ Y[i];
-	xsynd_multiply (CA2, Y, R1);
+	xsynd_multiply (xsynd_A2(), Y, R1);
 	for (int i = 0; i < 16; ++i) R1[i] = Y[i] ^ R1[i];
 }
 
@@ -471,14 +541,16 @@ void xsynd::gen (size_t n, byte*out)
 	}
 
 	while (n >= 128) {
-		xsynd_round (CA1, CA2, R1, (uint64_t*) out);
-		out += 128;
+		if (out) {
+			xsynd_round (R1, (uint64_t*) out);
+			out += 128;
+		} else xsynd_round (R1, (uint64_t*) block); //discarding
 		n -= 128;
 	}
 
 	if (!n) return;
 	blockpos = 0;
-	xsynd_round (CA1, CA2, R1, (uint64_t*) block);
+	xsynd_round (R1, (uint64_t*) block);
 
 	while (n) {
 		if (out) * (out++) = block[blockpos++];
@@ -486,3 +558,28 @@ void xsynd::gen (size_t n, byte*out)
 		--n;
 	}
 }
+
+void xsynd::xor_into (byte*data, size_t n)
+{
+	while (n && blockpos < 128) {
+		* (data++) ^= block[blockpos++];
+		--n;
+	}
+
+	uint64_t tmp[16];
+	while (n >= 128) {
+		xsynd_round (R1, tmp);
+		xor_bytes (data, (byte*) tmp, 128);
+		data += 128;
+		n -= 128;
+	}
+
+	if (!n) return;
+	blockpos = 0;
+	xsynd_round (R1, (uint64_t*) block);
+
+	while (n) {
+		* (data++) ^= block[blockpos++];
+		--n;
+	}
+}
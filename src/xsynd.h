@@ -54,6 +54,7 @@ public:
 	void load_key (const byte*begin, const byte*end);
 	byte gen();
 	void gen (size_t n, byte*out);
+	void xor_into (byte*data, size_t n);
 
 	//advisory values for effective usage
 	size_t key_size() {